@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "chesscore.h"
+
+using namespace std;
+
+/**
+ * Micro-benchmarks of the hot paths of chesscore, to compare builds and
+ * releases on the same machine. Every benchmark works on the same
+ * positions from random games with a fixed seed, so the numbers are
+ * reproducible, and reports the median of several timed runs. Builds with
+ * CHESS_STATS also report the heap allocations per operation.
+ */
+
+constexpr char USAGE_TEXT[] =
+    ("Usage: chess-bench [--json] [--filter <text>] [--min-time <ms>]\n"
+     "  --json            print the results as JSON\n"
+     "  --filter <text>   only run benchmarks whose name contains the text\n"
+     "  --min-time <ms>   time each benchmark runs at least, default 300\n");
+
+constexpr size_t POSITIONS = 1000;
+constexpr size_t SAMPLES = 5;
+
+struct Benchmark {
+  string name;
+  /** Operations done by one call of run */
+  size_t operations;
+  /** Returns a checksum, so the compiler can't skip the work */
+  function<uint64_t()> run;
+};
+
+struct BenchmarkResult {
+  string name;
+  uint64_t operations;
+  double ns_per_op;
+  /** Only counted with CHESS_STATS */
+  double allocations_per_op;
+};
+
+/** Positions of random games, in the order they were played */
+vector<Game> random_positions(const size_t count) {
+  mt19937 random(1);
+  vector<Game> positions;
+  positions.reserve(count);
+  while (positions.size() < count) {
+    Game game;
+    MoveList moves = generate_moves(game);
+    while (!moves.empty() && game.history.size() < 200 && positions.size() < count) {
+      apply_move(game, moves[random() % moves.size()]);
+      positions.push_back(game);
+      moves = generate_moves(game);
+    }
+  }
+  return positions;
+}
+
+/** An output stream that discards everything, to time drawing alone */
+class NullBuffer : public streambuf {
+ protected:
+  int overflow(const int c) override {
+    return c;
+  }
+
+  streamsize xsputn(const char *, const streamsize count) override {
+    return count;
+  }
+};
+
+vector<Benchmark> make_benchmarks() {
+  const auto positions = make_shared<vector<Game>>(random_positions(POSITIONS));
+  // one legal move per position, where there is one
+  auto moves = make_shared<vector<pair<size_t, Move>>>();
+  auto sans = make_shared<vector<pair<size_t, string>>>();
+  mt19937 random(2);
+  for (size_t i = 0; i < positions->size(); ++i) {
+    const MoveList legal = generate_moves((*positions)[i]);
+    if (!legal.empty()) {
+      const Move move = legal[random() % legal.size()];
+      moves->emplace_back(i, move);
+      sans->emplace_back(i, encode_move((*positions)[i], move));
+    }
+  }
+  auto null_buffer = make_shared<NullBuffer>();
+  auto null_output = make_shared<ostream>(null_buffer.get());
+
+  return {
+      {"decode_move", sans->size(),
+       [positions, sans] {
+         uint64_t sum = 0;
+         for (const auto &[i, san] : *sans) {
+           sum += decode_move((*positions)[i], san).data;
+         }
+         return sum;
+       }},
+      {"is_attacked", positions->size() * 64,
+       [positions] {
+         uint64_t sum = 0;
+         for (const Game &game : *positions) {
+           for (uint8_t square = 0; square < 64; ++square) {
+             sum += is_attacked(game.board, get_square(square), game.turn);
+           }
+         }
+         return sum;
+       }},
+      {"find_attacking_pieces", moves->size(),
+       [positions, moves] {
+         uint64_t sum = 0;
+         for (const auto &[i, move] : *moves) {
+           const Board &board = (*positions)[i].board;
+           const ColorPiece piece = *board.mailbox[move.from().index()];
+           sum += find_attacking_pieces(board, move.to(), piece).size();
+         }
+         return sum;
+       }},
+      {"is_checkmate", positions->size(),
+       [positions] {
+         uint64_t sum = 0;
+         for (const Game &game : *positions) {
+           sum += is_checkmate(game);
+         }
+         return sum;
+       }},
+      {"apply_undo_move", moves->size(),
+       [positions, moves] {
+         uint64_t sum = 0;
+         for (const auto &[i, move] : *moves) {
+           Game &game = (*positions)[i];
+           const Undo undo = apply_move(game, move);
+           sum += game.hash;
+           undo_move(game, move, undo);
+         }
+         return sum;
+       }},
+      {"generate_moves", positions->size(),
+       [positions, list = make_shared<MoveList>()] {
+         uint64_t sum = 0;
+         for (const Game &game : *positions) {
+           generate_moves(game, *list);
+           sum += list->size();
+         }
+         return sum;
+       }},
+      {"perft_4_node", 197281,
+       [] {
+         Game game;
+         return perft(game, 4);
+       }},
+      {"render_full", positions->size(),
+       [positions, null_output, null_buffer] {
+         // too small for a terminal, so every frame is drawn in full
+         BoardRenderer renderer(*null_output, 1);
+         for (const Game &game : *positions) {
+           renderer.draw(game);
+         }
+         return uint64_t(0);
+       }},
+      {"render_diff", positions->size(),
+       [positions, null_output, null_buffer] {
+         BoardRenderer renderer(*null_output, 50);
+         for (const Game &game : *positions) {
+           renderer.draw(game);
+         }
+         return uint64_t(0);
+       }},
+  };
+}
+
+/**
+ * Time the benchmark in SAMPLES runs of at least min_time / SAMPLES each,
+ * with as many calls as that takes, and keep the median.
+ */
+BenchmarkResult measure(const Benchmark &benchmark, const chrono::milliseconds min_time) {
+  static volatile uint64_t sink;
+  const auto time_calls = [&benchmark](const size_t calls) {
+    const auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; ++i) {
+      sink = sink + benchmark.run();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start);
+  };
+
+  const chrono::duration<double> sample_time = min_time / double(SAMPLES);
+  size_t calls = 1;
+  while (time_calls(calls) < sample_time / 4) {
+    calls *= 2;
+  }
+  calls = max<size_t>(1, calls * sample_time / max(time_calls(calls), sample_time / 4));
+
+  const uint64_t operations = calls * benchmark.operations * SAMPLES;
+  const uint64_t allocations = stat_counters[HEAP_ALLOCATIONS].calls;
+  vector<double> samples;
+  for (size_t i = 0; i < SAMPLES; ++i) {
+    samples.push_back(1e9 * time_calls(calls).count() / (calls * benchmark.operations));
+  }
+  ranges::sort(samples);
+  return {
+      benchmark.name,
+      operations,
+      samples[SAMPLES / 2],
+      double(stat_counters[HEAP_ALLOCATIONS].calls - allocations) / operations,
+  };
+}
+
+int main(int argc, char *argv[]) {
+  const vector<string> args(argv + 1, argv + argc);
+  bool json = false;
+  string filter = "";
+  chrono::milliseconds min_time(300);
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--json") {
+      json = true;
+    } else if (args[i] == "--filter" && i + 1 < args.size()) {
+      filter = args[++i];
+    } else if (args[i] == "--min-time" && i + 1 < args.size()) {
+      min_time = chrono::milliseconds(max(1, atoi(args[++i].c_str())));
+    } else {
+      cerr << USAGE_TEXT;
+      return args[i] == "--help" ? 0 : 1;
+    }
+  }
+
+  vector<BenchmarkResult> results;
+  if (!json) {
+    cout << left << setw(24) << "benchmark" << right << setw(12) << "ns/op" << setw(16)
+         << "ops/s" << (STATS_ENABLED ? "   allocs/op" : "") << endl;
+  }
+  for (const Benchmark &benchmark : make_benchmarks()) {
+    if (benchmark.name.find(filter) == string::npos) {
+      continue;
+    }
+    const BenchmarkResult result = measure(benchmark, min_time);
+    results.push_back(result);
+    if (!json) {
+      cout << left << setw(24) << result.name << right << fixed << setprecision(2)
+           << setw(12) << result.ns_per_op << setprecision(0) << setw(16)
+           << 1e9 / result.ns_per_op;
+      if (STATS_ENABLED) {
+        cout << setw(12) << setprecision(3) << result.allocations_per_op;
+      }
+      cout << defaultfloat << endl;
+    }
+  }
+
+  if (json) {
+    // one benchmark per line, in a fixed order, so results diff cleanly
+    cout << "{\n  \"version\": 1,\n  \"simd\": \"" << NNUE_SIMD
+         << "\",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+      const BenchmarkResult &result = results[i];
+      cout << "    {\"name\": \"" << result.name << "\", \"operations\": "
+           << result.operations << ", \"ns_per_op\": " << fixed << setprecision(3)
+           << result.ns_per_op << ", \"ops_per_second\": " << setprecision(0)
+           << 1e9 / result.ns_per_op;
+      if (STATS_ENABLED) {
+        cout << ", \"allocations_per_op\": " << setprecision(3)
+             << result.allocations_per_op;
+      }
+      cout << defaultfloat << "}"
+           << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    cout << "  ]\n}" << endl;
+  }
+  return 0;
+}
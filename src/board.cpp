@@ -0,0 +1,984 @@
+#include "board.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "nnue.h"
+
+using namespace std;
+
+string to_string(const ColorPiece &piece) {
+  return string(UTF8_PIECES[piece.piece][piece.color]);
+}
+
+string to_string(const Square &square) {
+  return {
+      static_cast<char>((square.file + 'a')),
+      static_cast<char>((square.rank + '1'))};
+}
+
+Square get_square(const string &square) {
+  return get_square(square[0], square[1]);
+}
+
+SquareList to_squares(Bitboard bitboard) {
+  SquareList squares;
+  while (bitboard) {
+    squares.push_back(get_square(pop_square(bitboard)));
+  }
+  return squares;
+}
+
+void attach_network(Game &game, const Network *network) {
+  game.network = network;
+  if (network) {
+    game.accumulator = refresh_accumulator(*network, game.board);
+  }
+}
+
+SquareList find_pieces(const Board &board, const ColorPiece &piece) {
+  return to_squares(board.of(piece));
+}
+
+/**
+ * Fill a slider's magic table. Its subsets of blockers are enumerated in the
+ * order of their PEXT, which saves computing it with BMI2.
+ */
+template <size_t N>
+constexpr void init_magics(
+    array<Magic, 64> &magics,
+    array<Bitboard, N> &table,
+    const array<Bitboard, 64> &magic_numbers,
+    const bool rook
+) {
+  // Writing every entry in order first keeps the compiler's evaluation fast
+  // when the magic numbers scatter the writes below.
+  table.fill(0);
+  uint32_t offset = 0;
+  for (uint8_t index = 0; index < 64; ++index) {
+    const Square square = get_square(index);
+    // Blockers on the board's edge never change the attacked squares.
+    const Bitboard edges = ((RANK_1 | RANK_1 << 56) & ~(RANK_1 << 8 * square.rank))
+                           | ((FILE_A | FILE_A << 7) & ~(FILE_A << square.file));
+    const Bitboard mask = slide(index, rook, 0) & ~edges;
+    const Magic magic = {mask, magic_numbers[index], offset, uint8(64 - popcount(mask))};
+    magics[index] = magic;
+    // Enumerate all subsets of the mask (Carry-Rippler)
+    Bitboard blockers = 0;
+    uint32_t subset = 0;
+    do {
+      table[Magic::PEXT ? offset + subset : magic.index(blockers)] =
+          slide(index, rook, blockers);
+      blockers = (blockers - mask) & mask;
+      ++subset;
+    } while (blockers);
+    offset += subset;
+  }
+  if (offset != N) {
+    throw string("The magic table has the wrong size.");
+  }
+}
+
+constexpr AttackTables make_attack_tables() {
+  AttackTables tables = {};
+  for (uint8_t index = 0; index < 64; ++index) {
+    const Square square = get_square(index);
+    tables.knight[index] = step_attacks<8>(square, KNIGHT_STEPS);
+    tables.king[index] = step_attacks<8>(square, KING_STEPS);
+    tables.pawn[white][index] = step_attacks<2>(square, {{{-1, +1}, {+1, +1}}});
+    tables.pawn[black][index] = step_attacks<2>(square, {{{-1, -1}, {+1, -1}}});
+  }
+  init_magics(tables.bishop_magics, tables.bishop, BISHOP_MAGIC_NUMBERS, false);
+  init_magics(tables.rook_magics, tables.rook, ROOK_MAGIC_NUMBERS, true);
+  for (uint8_t a = 0; a < 64; ++a) {
+    for (uint8_t direction = 0; direction < 8; ++direction) {
+      Bitboard targets = RAYS[direction][a];
+      while (targets) {
+        const uint8_t b = pop_square(targets);
+        tables.line[a][b] = RAYS[direction][a] | RAYS[direction ^ 1][a] | square_mask(a);
+        tables.between[a][b] = RAYS[direction][a] & RAYS[direction ^ 1][b];
+      }
+    }
+  }
+  return tables;
+}
+
+constexpr AttackTables ATTACKS = make_attack_tables();
+
+// A sample of squares whose attacks are easy to check by hand
+static_assert(ATTACKS.knight[0] == (square_mask(10) | square_mask(17)));
+static_assert(popcount(ATTACKS.knight[27]) == 8 && popcount(ATTACKS.king[27]) == 8);
+static_assert(ATTACKS.king[63] == (square_mask(54) | square_mask(55) | square_mask(62)));
+static_assert(ATTACKS.pawn[white][8] == square_mask(17));
+static_assert(ATTACKS.pawn[black][52] == (square_mask(43) | square_mask(45)));
+static_assert(ATTACKS.between[0][63] == 0x0040201008040200);
+static_assert(ATTACKS.between[0][7] == 0x7e && ATTACKS.between[0][1] == 0);
+static_assert(ATTACKS.between[0][10] == 0 && ATTACKS.line[0][10] == 0);
+static_assert(ATTACKS.line[9][0] == 0x8040201008040201);
+static_assert(ATTACKS.rook[ATTACKS.rook_magics[0].index(0)] == 0x01010101010101fe);
+static_assert(ATTACKS.bishop[ATTACKS.bishop_magics[0].index(0)] == 0x8040201008040200);
+// Sliders stop at the first blocker, whichever the direction
+static_assert(ATTACKS.rook[ATTACKS.rook_magics[27].index(0x80002000001)] == 0x808f6080808);
+static_assert(ATTACKS.bishop[ATTACKS.bishop_magics[27].index(0x200000000200)] == 0x1221400142240);
+
+SquareList find_attacking_pieces(
+    const Board &board,
+    const Square &target_square,
+    const ColorPiece &piece,
+    const optional<uint8_t> file,
+    const optional<uint8_t> rank
+) {
+  count_stat(static_cast<Stat>(ATTACKING_PAWNS + uint8(piece.piece)));
+  // Attacks are symmetric: look from the target square with the opposite
+  // color's pattern (only matters for pawns).
+  Bitboard found = attacks(
+                       invert(piece), target_square.index(), board.occupied
+                   )
+                   & board.of(piece);
+  if (file) {
+    found &= FILE_A << *file;
+  }
+  if (rank) {
+    found &= RANK_1 << 8 * *rank;
+  }
+  return to_squares(found);
+}
+
+/** All squares attacked by the given pieces, which are of the given type */
+template <Piece piece>
+Bitboard all_attacks(Bitboard pieces, const Bitboard occupied) {
+  Bitboard attacked = 0;
+  while (pieces) {
+    attacked |= attacks<piece>(pop_square(pieces), occupied);
+  }
+  return attacked;
+}
+
+Bitboard attacked_squares(const Board &board, const Color color) {
+  const Bitboard pawns = board.of({color, PAWN});
+  const Bitboard occupied = board.occupied;
+  return (color ? (pawns & ~FILE_A) << 7 | (pawns & ~(FILE_A << 7)) << 9
+                : (pawns & ~FILE_A) >> 9 | (pawns & ~(FILE_A << 7)) >> 7)
+         | all_attacks<KNIGHT>(board.of({color, KNIGHT}), occupied)
+         | all_attacks<BISHOP>(board.of({color, BISHOP}), occupied)
+         | all_attacks<ROOK>(board.of({color, ROOK}), occupied)
+         | all_attacks<QUEEN>(board.of({color, QUEEN}), occupied)
+         | all_attacks<KING>(board.of({color, KING}), occupied);
+}
+
+Threats find_threats(const Board &board, const Color turn) {
+  const Color them = invert(turn);
+  const uint8_t king = countr_zero(board.of({turn, KING}));
+  Threats threats = {attackers(board, king, them, board.occupied), 0};
+  Bitboard snipers =
+      (rook_attacks(king, board.colors[them])
+           & (board.pieces[ROOK] | board.pieces[QUEEN])
+       | bishop_attacks(king, board.colors[them])
+             & (board.pieces[BISHOP] | board.pieces[QUEEN]))
+      & board.colors[them];
+  while (snipers) {
+    const Bitboard blockers =
+        ATTACKS.between[king][pop_square(snipers)] & board.occupied;
+    if (popcount(blockers) == 1) {
+      threats.pinned |= blockers & board.colors[turn];
+    }
+  }
+  return threats;
+}
+
+bool is_in_check(const Game &game, Color color) {
+  if (color == game.turn) {
+    return game.threats.checkers;
+  }
+  const Board &board = game.board;
+  const uint8_t king = countr_zero(board.of({color, KING}));
+  return attackers(board, king, invert(color), board.occupied);
+}
+
+Move decode_move(const Game &game, const string_view move) {
+  const auto &[board, history, turn, can_castle, en_passant, halfmove_clock, fullmove_number, hash, previous_hashes, starting_fen, threats, network, accumulator, copies] =
+      game;
+  const optional<SanMove> san = parse_san(move);
+  if (!san) {
+    throw "'" + string(move) + "' is not a known move format.";
+  }
+
+  const ColorPiece piece = {turn, san->piece};
+  Square from;
+  Square to = san->to;
+  const int8_t forwards = turn ? 1 : -1;
+
+  if (san->castling) {
+    const StatTimer timer(DECODE_CASTLING);
+    const bool castle_long = san->castling == SanMove::QUEEN_SIDE;
+    if (castle_long ? !can_castle[turn].queen_side
+                    : !can_castle[turn].king_side) {
+      throw string("You can no longer castle on this side of the board, "
+                   "the King or Rook has already moved.");
+    }
+    const uint8_t rank = turn ? 0 : 7;
+    if (get_piece(board, {uint8(castle_long ? 0 : 7), rank})
+        != ColorPiece{turn, ROOK}) {
+      throw string("You cannot castle on this side of the board, "
+                   "there is no Rook in the corner.");
+    }
+    const Bitboard path = castle_long ? 0b1110 : 0b1100000;
+    if (board.occupied & path << 8 * rank) {
+      throw string("You cannot castle on this side of the board, "
+                   "there is a piece in the way.");
+    }
+    if (is_in_check(game, turn)) {
+      throw string("You cannot castle while in check.");
+    }
+    if (is_attacked(board, {uint8(castle_long ? 3 : 5), rank}, invert(turn))) {
+      throw string("You cannot castle on this side of the board, "
+                   "the King may not pass through check.");
+    }
+    from = Square{4, rank};
+    to = Square{uint8(castle_long ? 2 : 6), rank};
+    return Move(from, to, Move::CASTLING);
+
+  } else if (san->piece == PAWN && to.rank == (turn ? 0 : 7)) {
+    // nothing can be behind the own first rank to come from
+    throw string("Pawns can't move to their own first rank.");
+
+  } else if (san->piece == PAWN && !san->capture) {  // "e4"
+    const StatTimer timer(DECODE_PAWN_PUSH);
+    from.file = to.file;
+
+    if (get_piece(board, {from.file, uint8(to.rank - forwards)}) == piece) {
+      from.rank = to.rank - forwards;
+
+    } else if ((turn && to.rank == 3 || !turn && to.rank == 4) &&
+               !get_piece(board, {from.file, uint8(to.rank - forwards)}) &&
+               get_piece(board, {from.file, uint8(to.rank - 2 * forwards)})
+                   == piece) {
+      // Move two spaces from starting rank
+      from.rank = to.rank - 2 * forwards;
+    } else {
+      throw string(
+          "There is no eligible Pawn on "
+          + to_string(Square{from.file, uint8(to.rank - forwards)})
+          + " or "
+          + to_string(Square{from.file, uint8(to.rank - 2 * forwards)})
+          + "."
+      );
+    }
+
+    // Prevent illegal capture
+    if (get_piece(board, to)) {
+      throw string(
+          to_string(to) + " is blocked. Pawns can only capture diagonally."
+      );
+    }
+
+    return Move(
+        from,
+        to,
+        get_promotion(to, turn, san->promotion),
+        san->promotion.value_or(KNIGHT)
+    );
+
+  } else if (san->piece == PAWN) {  // "dxe4"
+    const StatTimer timer(DECODE_PAWN_CAPTURE);
+    from = {*san->from_file, uint8(to.rank - forwards)};
+    if (abs(from.file - to.file) != 1) {
+      throw string("Pawn must move one square diagonally when capturing.");
+    }
+    if (get_piece(board, from) != piece) {
+      throw string("No eligible Pawn on " + to_string(from) + ".");
+    }
+    const optional<ColorPiece> capture = get_piece(board, to);
+    if (!capture) {
+      // Check for en passant capture
+      if (get_piece(board, {to.file, from.rank}) == invert(piece)) {
+        // check if opponent's pawn just moved by two ranks
+        if (en_passant == to) {
+          return Move(from, to, Move::EN_PASSANT);
+        } else {
+          throw string("Can't capture en passant, the opposing pawn was moved "
+                       "too long ago.");
+        }
+      } else {
+        throw string("There is nothing to capture on " + to_string(to) + ".");
+      }
+    }
+    if (turn == capture->color) {
+      throw string("Can't capture your own piece.");
+    }
+
+    return Move(
+        from,
+        to,
+        get_promotion(to, turn, san->promotion),
+        san->promotion.value_or(KNIGHT)
+    );
+
+  } else {
+    // "Qe4, Qxe4, Qde4, Qdxe4, Q3e4, Q3xe4, Qd3e4, Qd3xe4"
+    const StatTimer timer(DECODE_PIECE);
+    SquareList candidates = find_attacking_pieces(
+        board, to, piece, san->from_file, san->from_rank
+    );
+    if (candidates.size() > 1) {
+      // SAN only disambiguates between legal moves, ignore pinned pieces.
+      const uint8_t king = countr_zero(board.of({turn, KING}));
+      erase_if(candidates, [&](const Square &from) {
+        const Bitboard after =
+            board.occupied ^ square_mask(from) | square_mask(to);
+        return attackers(board, king, invert(turn), after)
+               & ~square_mask(to);
+      });
+    }
+    switch (candidates.size()) {
+      case 1:
+        from = candidates[0];
+        break;
+      case 0:
+        throw string("No candidate pieces available.");
+      default:
+        throw string("Ambiguous move: multiple pieces available.");
+    }
+
+    // Check for captures
+    const optional<ColorPiece> capture = get_piece(board, to);
+    if (san->capture) {
+      if (!capture) {
+        throw string("There is nothing to capture on " + to_string(to) + ".");
+      } else if (turn == capture->color) {
+        throw string("Can't capture your own piece.");
+      }
+    } else {
+      if (capture) {
+        throw string("Target square is occupied")
+            + (turn == capture->color ? " by your own piece."
+                                      : ", add 'x' to capture.");
+      }
+    }
+    return Move(from, to);
+  }
+}
+
+uint64_t hash_castling(const array<Game::CanCastle, 2> &can_castle) {
+  uint64_t hash = 0;
+  for (const Color color : {white, black}) {
+    if (can_castle[color].king_side) {
+      hash ^= ZOBRIST.castling[color][0];
+    }
+    if (can_castle[color].queen_side) {
+      hash ^= ZOBRIST.castling[color][1];
+    }
+  }
+  return hash;
+}
+
+uint64_t hash_en_passant(const Game &game) {
+  if (game.en_passant
+      && ATTACKS.pawn[invert(game.turn)][game.en_passant->index()]
+             & game.board.of({game.turn, PAWN})) {
+    return ZOBRIST.en_passant[game.en_passant->file];
+  }
+  return 0;
+}
+
+uint64_t hash_game(const Game &game) {
+  return hash_pieces(game.board) ^ hash_castling(game.can_castle)
+         ^ hash_en_passant(game) ^ (game.turn ? 0 : ZOBRIST.black_to_move);
+}
+
+Undo apply_move(Game &game, const Move &move) {
+  auto &[board, history, turn, can_castle, en_passant, halfmove_clock, fullmove_number, hash, previous_hashes, starting_fen, threats, network, accumulator, copies] =
+      game;
+  count_stat(MOVES_APPLIED);
+  const Square from = move.from();
+  const Square to = move.to();
+  const ColorPiece piece = *get_piece(board, from);
+  Undo undo = {get_piece(board, to), can_castle, en_passant, halfmove_clock, hash, threats};
+
+  previous_hashes.push_back(hash);
+  hash ^= hash_castling(can_castle) ^ hash_en_passant(game);
+
+  const auto remove = [&board, &hash, network, &accumulator](const Square &square) {
+    if (const optional<ColorPiece> removed = get_piece(board, square)) {
+      hash ^= ZOBRIST.pieces[removed->color][removed->piece][square.index()];
+      if (network) {
+        subtract_feature(accumulator, *network, *removed, square.index());
+      }
+      board.remove(square);
+    }
+  };
+  const auto put = [&board, &hash, network, &accumulator](
+                       const Square &square, const ColorPiece &piece
+                   ) {
+    hash ^= ZOBRIST.pieces[piece.color][piece.piece][square.index()];
+    if (network) {
+      add_feature(accumulator, *network, piece, square.index());
+    }
+    board.put(square, piece);
+  };
+
+  // capture en passant
+  if (move.flag() == Move::EN_PASSANT) {
+    undo.capture = get_piece(board, {to.file, from.rank});
+    remove({to.file, from.rank});
+  }
+
+  // move
+  remove(from);
+  remove(to);
+  put(to, {turn, move.promotion().value_or(piece.piece)});
+
+  // castling
+  if (move.flag() == Move::CASTLING) {
+    if (to.file == 2) {  // castling long
+      remove({0, to.rank});
+      put({3, to.rank}, {turn, ROOK});
+    } else {  // castling short
+      remove({7, to.rank});
+      put({5, to.rank}, {turn, ROOK});
+    }
+  }
+  if (from.rank == (turn ? 0 : 7)) {
+    if (piece.piece == KING) {
+      can_castle[turn] = {false, false};
+    } else if (piece.piece == ROOK) {
+      if (from.file == 0) {
+        can_castle[turn].queen_side = false;
+      } else if (from.file == 7) {
+        can_castle[turn].king_side = false;
+      }
+    }
+  }
+  // capturing a rook on its starting square
+  if (to.rank == (turn ? 7 : 0)) {
+    if (to.file == 0) {
+      can_castle[invert(turn)].queen_side = false;
+    } else if (to.file == 7) {
+      can_castle[invert(turn)].king_side = false;
+    }
+  }
+
+  if (piece.piece == PAWN && abs(from.rank - to.rank) == 2) {
+    en_passant = Square{from.file, uint8((from.rank + to.rank) / 2)};
+  } else {
+    en_passant = nullopt;
+  }
+
+  halfmove_clock = piece.piece == PAWN || undo.capture ? 0 : halfmove_clock + 1;
+  fullmove_number += turn == black;
+  history.push_back(move);
+  turn = invert(turn);
+  hash ^= hash_castling(can_castle) ^ hash_en_passant(game) ^ ZOBRIST.black_to_move;
+  threats = find_threats(board, turn);
+  return undo;
+}
+
+void undo_move(Game &game, const Move &move, const Undo &undo) {
+  auto &[board, history, turn, can_castle, en_passant, halfmove_clock, fullmove_number, hash, previous_hashes, starting_fen, threats, network, accumulator, copies] =
+      game;
+  const Square from = move.from();
+  const Square to = move.to();
+  turn = invert(turn);
+  const ColorPiece piece =
+      move.promotion() ? ColorPiece{turn, PAWN} : *get_piece(board, to);
+
+  // the hash is restored as a whole, only the accumulator follows each piece
+  const auto remove = [&board, network, &accumulator](const Square &square) {
+    if (network) {
+      subtract_feature(accumulator, *network, *get_piece(board, square), square.index());
+    }
+    board.remove(square);
+  };
+  const auto put = [&board, network, &accumulator](
+                       const Square &square, const ColorPiece &piece
+                   ) {
+    if (network) {
+      add_feature(accumulator, *network, piece, square.index());
+    }
+    board.put(square, piece);
+  };
+
+  remove(to);
+  put(from, piece);
+  if (move.flag() == Move::EN_PASSANT) {
+    put({to.file, from.rank}, *undo.capture);
+  } else if (undo.capture) {
+    put(to, *undo.capture);
+  }
+
+  if (move.flag() == Move::CASTLING) {
+    const bool castle_long = to.file == 2;
+    remove({uint8(castle_long ? 3 : 5), to.rank});
+    put({uint8(castle_long ? 0 : 7), to.rank}, {turn, ROOK});
+  }
+
+  can_castle = undo.can_castle;
+  en_passant = undo.en_passant;
+  halfmove_clock = undo.halfmove_clock;
+  fullmove_number -= turn == black;
+  hash = undo.hash;
+  threats = undo.threats;
+  history.pop_back();
+  previous_hashes.pop_back();
+}
+
+string to_fen(const Game &game) {
+  string fen;
+  for (int8_t rank = 7; rank >= 0; --rank) {
+    uint8_t empty = 0;
+    for (uint8_t file = 0; file < 8; ++file) {
+      const optional<ColorPiece> piece = game.board.mailbox[rank * 8 + file];
+      if (!piece) {
+        ++empty;
+        continue;
+      }
+      if (empty) {
+        fen += char('0' + exchange(empty, 0));
+      }
+      const char letter = "PNBRQK"[piece->piece];
+      fen += piece->color ? letter : char(tolower(letter));
+    }
+    if (empty) {
+      fen += char('0' + empty);
+    }
+    fen += rank ? "/" : "";
+  }
+  fen += game.turn ? " w " : " b ";
+  const size_t castling = fen.size();
+  for (const Color color : {white, black}) {
+    if (game.can_castle[color].king_side) {
+      fen += color ? 'K' : 'k';
+    }
+    if (game.can_castle[color].queen_side) {
+      fen += color ? 'Q' : 'q';
+    }
+  }
+  if (fen.size() == castling) {
+    fen += '-';
+  }
+  fen += ' ';
+  fen += game.en_passant ? to_string(*game.en_passant) : "-";
+  return fen + " " + to_string(game.halfmove_clock) + " " + to_string(game.fullmove_number);
+}
+
+bool is_threefold_repetition(const Game &game) {
+  return ranges::count(game.previous_hashes, game.hash) >= 2;
+}
+
+bool is_insufficient_material(const Board &board) {
+  const Bitboard others = board.occupied & ~board.pieces[KING];
+  return others == (others & (board.pieces[KNIGHT] | board.pieces[BISHOP]))
+      && popcount(others) <= 1;
+}
+
+void add_moves(
+    MoveList &moves, const Piece piece, const uint8_t from, Bitboard targets
+) {
+  while (targets) {
+    const Square to = get_square(pop_square(targets));
+    if (piece == PAWN && (to.rank == 0 || to.rank == 7)) {
+      for (const Piece promotion : {QUEEN, ROOK, BISHOP, KNIGHT}) {
+        moves.emplace_back(get_square(from), to, Move::PROMOTION, promotion);
+      }
+    } else {
+      moves.emplace_back(get_square(from), to);
+    }
+  }
+}
+
+/** Moves of all pieces of one type that may move anywhere in targets */
+template <Piece piece>
+void add_piece_moves(
+    MoveList &moves,
+    const Board &board,
+    const Color turn,
+    const Bitboard targets,
+    const Bitboard pinned,
+    const uint8_t king
+) {
+  Bitboard pieces = board.of({turn, piece});
+  while (pieces) {
+    const uint8_t from = pop_square(pieces);
+    Bitboard to = attacks<piece>(from, board.occupied) & targets;
+    if (pinned & square_mask(from)) {
+      to &= ATTACKS.line[king][from];
+    }
+    add_moves(moves, piece, from, to);
+  }
+}
+
+/**
+ * generate_moves for one side and selection, so the directions and the
+ * kinds of moves are known when compiling
+ */
+template <Color turn, MoveSelection selection>
+void generate_moves(const Game &game, MoveList &moves) {
+  const auto &[board, history, _, can_castle, en_passant, halfmove_clock, fullmove_number, hash, previous_hashes, starting_fen, threats, network, accumulator, copies] =
+      game;
+  constexpr Color them = invert(turn);
+  const Bitboard ours = board.colors[turn];
+  const Bitboard theirs = board.colors[them];
+  const Bitboard occupied = board.occupied;
+  const uint8_t king = countr_zero(board.of({turn, KING}));
+  const Bitboard checkers = threats.checkers;
+  const Bitboard pinned = threats.pinned;
+
+  constexpr bool captures = selection != MoveSelection::QUIETS;
+  constexpr bool quiets = selection != MoveSelection::CAPTURES;
+  // squares the pieces may move to, by the selection
+  const Bitboard selected = (captures ? theirs : 0) | (quiets ? ~occupied : 0);
+
+  moves.clear();
+
+  // The King may step anywhere that is not attacked once he has left his
+  // square – sliders must not be able to see through him.
+  Bitboard king_targets = ATTACKS.king[king] & ~ours & selected;
+  while (king_targets) {
+    const uint8_t to = pop_square(king_targets);
+    if (!attackers(board, to, them, occupied ^ square_mask(king))) {
+      add_moves(moves, KING, king, square_mask(to));
+    }
+  }
+  if (popcount(checkers) > 1) {
+    return;
+  }
+
+  // Squares that resolve a single check, or anything not our own otherwise
+  const Bitboard evasions =
+      checkers ? ATTACKS.between[king][countr_zero(checkers)] | checkers : ~ours;
+  Bitboard targets = evasions & selected;
+
+  add_piece_moves<KNIGHT>(moves, board, turn, targets, pinned, king);
+  add_piece_moves<BISHOP>(moves, board, turn, targets, pinned, king);
+  add_piece_moves<ROOK>(moves, board, turn, targets, pinned, king);
+  add_piece_moves<QUEEN>(moves, board, turn, targets, pinned, king);
+
+  constexpr int8_t forwards = turn ? 8 : -8;
+  constexpr Bitboard start_rank = RANK_1 << (turn ? 8 : 48);
+  constexpr Bitboard last_rank = RANK_1 << (turn ? 56 : 0);
+  // promotions count as captures, even without taking anything
+  targets = evasions
+          & (captures ? theirs | last_rank : 0)
+          | evasions & (quiets ? ~occupied & ~last_rank : 0);
+  Bitboard pawns = board.of({turn, PAWN});
+  while (pawns) {
+    const uint8_t from = pop_square(pawns);
+    Bitboard to = attacks<PAWN, turn>(from, occupied) & theirs;
+    const Bitboard single = square_mask(from + forwards) & ~occupied;
+    to |= single;
+    if (single && start_rank & square_mask(from)) {
+      to |= square_mask(from + 2 * forwards) & ~occupied;
+    }
+    to &= targets;
+    if (pinned & square_mask(from)) {
+      to &= ATTACKS.line[king][from];
+    }
+    add_moves(moves, PAWN, from, to);
+  }
+
+  if (captures && en_passant) {
+    // Captured pawn and capturing pawn both leave their ranks at once, which
+    // can expose the King – simply test the resulting occupancy.
+    const uint8_t to = en_passant->index();
+    const uint8_t captured = to - forwards;
+    Bitboard capturing =
+        attacks<PAWN, them>(to, occupied) & board.of({turn, PAWN});
+    while (capturing) {
+      const uint8_t from = pop_square(capturing);
+      const Bitboard after = occupied ^ square_mask(from) ^ square_mask(captured)
+                             | square_mask(to);
+      if (!(attackers(board, king, them, after) & ~square_mask(captured))) {
+        moves.emplace_back(get_square(from), get_square(to), Move::EN_PASSANT);
+      }
+    }
+  }
+
+  if (quiets && !checkers) {
+    constexpr uint8_t rank = turn ? 0 : 56;
+    const Bitboard rooks = board.of({turn, ROOK});
+    if (can_castle[turn].king_side && king == rank + 4
+        && rooks & square_mask(rank + 7) && !(occupied & 0b1100000ULL << rank)
+        && !attackers(board, rank + 5, them, occupied)
+        && !attackers(board, rank + 6, them, occupied)) {
+      moves.emplace_back(get_square(king), get_square(rank + 6), Move::CASTLING);
+    }
+    if (can_castle[turn].queen_side && king == rank + 4
+        && rooks & square_mask(rank) && !(occupied & 0b1110ULL << rank)
+        && !attackers(board, rank + 3, them, occupied)
+        && !attackers(board, rank + 2, them, occupied)) {
+      moves.emplace_back(get_square(king), get_square(rank + 2), Move::CASTLING);
+    }
+  }
+}
+
+void generate_moves(const Game &game, MoveList &moves, const MoveSelection selection) {
+  if (selection == MoveSelection::CAPTURES) {
+    return game.turn ? generate_moves<white, MoveSelection::CAPTURES>(game, moves)
+                     : generate_moves<black, MoveSelection::CAPTURES>(game, moves);
+  }
+  if (selection == MoveSelection::QUIETS) {
+    return game.turn ? generate_moves<white, MoveSelection::QUIETS>(game, moves)
+                     : generate_moves<black, MoveSelection::QUIETS>(game, moves);
+  }
+  return game.turn ? generate_moves<white, MoveSelection::ALL>(game, moves)
+                   : generate_moves<black, MoveSelection::ALL>(game, moves);
+}
+
+MoveList generate_moves(const Game &game) {
+  MoveList moves;
+  generate_moves(game, moves);
+  return moves;
+}
+
+bool has_legal_moves(const Game &game) {
+  const Board &board = game.board;
+  const uint8_t king = countr_zero(board.of({game.turn, KING}));
+  const Bitboard occupied = board.occupied ^ square_mask(king);
+  Bitboard targets =
+      game.threats.checkers ? 0 : ATTACKS.king[king] & ~board.colors[game.turn];
+  while (targets) {
+    if (!attackers(board, pop_square(targets), invert(game.turn), occupied)) {
+      return true;
+    }
+  }
+  return !generate_moves(game).empty();
+}
+
+bool is_legal(const Game &game, const Move &move) {
+  const Board &board = game.board;
+  const Color turn = game.turn;
+  const Color them = invert(turn);
+  const uint8_t from = move.from().index();
+  const uint8_t to = move.to().index();
+  const optional<ColorPiece> piece = board.mailbox[from];
+  if (!piece || piece->color != turn || board.colors[turn] & square_mask(to)
+      || (move.flag() != Move::PROMOTION && move.data >> 12 & 0b11)) {
+    return false;
+  }
+  const uint8_t king = countr_zero(board.of({turn, KING}));
+  const Bitboard checkers = game.threats.checkers;
+  const int8_t forwards = turn ? 8 : -8;
+
+  if (move.flag() == Move::CASTLING) {
+    const uint8_t rank = turn ? 0 : 56;
+    const bool king_side = to == rank + 6;
+    if (checkers || piece->piece != KING || from != rank + 4
+        || (!king_side && to != rank + 2)
+        || !(king_side ? game.can_castle[turn].king_side
+                       : game.can_castle[turn].queen_side)
+        || board.mailbox[king_side ? rank + 7 : rank] != ColorPiece{turn, ROOK}
+        || board.occupied & (king_side ? 0b1100000ULL : 0b1110ULL) << rank) {
+      return false;
+    }
+    const int8_t step = king_side ? 1 : -1;
+    return !attackers(board, from + step, them, board.occupied)
+        && !attackers(board, from + 2 * step, them, board.occupied);
+  }
+  if (move.flag() == Move::EN_PASSANT) {
+    if (piece->piece != PAWN || game.en_passant != move.to()
+        || !(ATTACKS.pawn[them][to] & square_mask(from))) {
+      return false;
+    }
+    const uint8_t captured = to - forwards;
+    const Bitboard after = board.occupied ^ square_mask(from)
+                         ^ square_mask(captured) | square_mask(to);
+    return !(attackers(board, king, them, after) & ~square_mask(captured));
+  }
+  if (piece->piece == KING) {
+    return move.flag() == Move::NORMAL && ATTACKS.king[from] & square_mask(to)
+        && !attackers(board, to, them, board.occupied ^ square_mask(king));
+  }
+
+  const Bitboard evasions = checkers
+                              ? ATTACKS.between[king][countr_zero(checkers)] | checkers
+                              : ~Bitboard(0);
+  if (popcount(checkers) > 1 || !(evasions & square_mask(to))
+      || (game.threats.pinned & square_mask(from)
+          && !(ATTACKS.line[king][from] & square_mask(to)))) {
+    return false;
+  }
+  if (piece->piece != PAWN) {
+    return move.flag() == Move::NORMAL
+        && attacks(*piece, from, board.occupied) & square_mask(to);
+  }
+  const bool last_rank = to / 8 == (turn ? 7 : 0);
+  if (last_rank != (move.flag() == Move::PROMOTION)) {
+    return false;
+  }
+  if (board.mailbox[to]) {
+    return ATTACKS.pawn[turn][from] & square_mask(to);
+  }
+  const uint8_t start_rank = turn ? 1 : 6;
+  return to == from + forwards
+      || (to == from + 2 * forwards && from / 8 == start_rank
+          && !board.mailbox[from + forwards]);
+}
+
+bool is_checkmate(const Game &game) {
+  return game.threats.checkers && !has_legal_moves(game);
+}
+
+bool is_stalemate(const Game &game) {
+  return !game.threats.checkers && !has_legal_moves(game);
+}
+
+string encode_move(Game &game, const Move &move) {
+  const Square from = move.from();
+  const Square to = move.to();
+  const Piece piece = game.board.mailbox[from.index()]->piece;
+  const bool capture =
+      game.board.mailbox[to.index()] || move.flag() == Move::EN_PASSANT;
+  string san;
+  if (move.flag() == Move::CASTLING) {
+    san = to.file == 2 ? "O-O-O" : "O-O";
+  } else if (piece == PAWN) {
+    if (capture) {
+      san = string{static_cast<char>(from.file + 'a'), 'x'};
+    }
+    san += to_string(to);
+    if (move.promotion()) {
+      san += string{'=', "PNBRQK"[*move.promotion()]};
+    }
+  } else {
+    san = "PNBRQK"[piece];
+    bool ambiguous = false, same_file = false, same_rank = false;
+    for (const Move &other : generate_moves(game)) {
+      const Square other_from = other.from();
+      if (other.to() == to && !(other_from == from)
+          && game.board.mailbox[other_from.index()]->piece == piece) {
+        ambiguous = true;
+        same_file |= other_from.file == from.file;
+        same_rank |= other_from.rank == from.rank;
+      }
+    }
+    if (ambiguous && (!same_file || same_rank)) {
+      san += static_cast<char>(from.file + 'a');
+    }
+    if (ambiguous && same_file) {
+      san += static_cast<char>(from.rank + '1');
+    }
+    if (capture) {
+      san += 'x';
+    }
+    san += to_string(to);
+  }
+
+  const Undo undo = apply_move(game, move);
+  if (game.threats.checkers) {
+    san += has_legal_moves(game) ? '+' : '#';
+  }
+  undo_move(game, move, undo);
+  return san;
+}
+
+string to_long_algebraic(const Move &move) {
+  string result = to_string(move.from()) + to_string(move.to());
+  if (move.promotion()) {
+    result += "pnbrqk"[*move.promotion()];
+  }
+  return result;
+}
+
+Game parse_fen(const string &fen) {
+  istringstream fields(fen);
+  string placement, turn, castling, en_passant;
+  if (!(fields >> placement >> turn >> castling >> en_passant)) {
+    throw string("FEN needs at least four fields.");
+  }
+  // the move counters are optional, as many tools leave them out
+  int halfmove_clock = 0, fullmove_number = 1;
+  fields >> halfmove_clock >> fullmove_number;
+  if (halfmove_clock < 0 || fullmove_number < 1) {
+    throw string("Invalid FEN move counters.");
+  }
+
+  Game game;
+  game.board = Board();
+  uint8_t file = 0;
+  uint8_t rank = 7;
+  for (const char c : placement) {
+    if (c == '/') {
+      if (file != 8 || rank == 0) {
+        throw string("Invalid FEN rank in '") + placement + "'";
+      }
+      file = 0;
+      --rank;
+    } else if ('1' <= c && c <= '8') {
+      file += c - '0';
+    } else if (file < 8) {
+      game.board.put({file++, rank}, get_piece(toupper(c), isupper(c) ? white : black));
+    } else {
+      throw string("Invalid FEN rank in '") + placement + "'";
+    }
+  }
+  if (file != 8 || rank != 0) {
+    throw string("FEN must describe all 64 squares.");
+  }
+  for (const Color color : {white, black}) {
+    if (popcount(game.board.of({color, KING})) != 1) {
+      throw string("You need exactly one King.");
+    }
+  }
+  if (game.board.pieces[PAWN] & (RANK_1 | RANK_1 << 56)) {
+    throw string("Pawns can't stand on the first or last rank.");
+  }
+
+  if (turn != "w" && turn != "b") {
+    throw string("Invalid side to move '") + turn + "'";
+  }
+  game.turn = turn == "w" ? white : black;
+  if (is_in_check(game, invert(game.turn))) {
+    throw string("The side that just moved can't be in check.");
+  }
+
+  game.can_castle = {{{false, false}, {false, false}}};
+  for (const char c : castling) {
+    switch (c) {
+      case 'K':
+        game.can_castle[white].king_side = true;
+        break;
+      case 'Q':
+        game.can_castle[white].queen_side = true;
+        break;
+      case 'k':
+        game.can_castle[black].king_side = true;
+        break;
+      case 'q':
+        game.can_castle[black].queen_side = true;
+        break;
+      case '-':
+        break;
+      default:
+        throw string("Invalid castling rights '") + castling + "'";
+    }
+  }
+  // drop rights that can never be used, as the King or Rook isn't home
+  for (const Color color : {white, black}) {
+    const uint8_t rank = color ? 0 : 7;
+    const optional<ColorPiece> king = get_piece(game.board, {4, rank});
+    if (king != ColorPiece{color, KING}) {
+      game.can_castle[color] = {false, false};
+    }
+    if (get_piece(game.board, {7, rank}) != ColorPiece{color, ROOK}) {
+      game.can_castle[color].king_side = false;
+    }
+    if (get_piece(game.board, {0, rank}) != ColorPiece{color, ROOK}) {
+      game.can_castle[color].queen_side = false;
+    }
+  }
+
+  if (en_passant != "-") {
+    // the square the pawn that just moved two squares skipped
+    if (en_passant.size() != 2 || !get_square(en_passant).exists()
+        || get_square(en_passant).rank != (game.turn ? 5 : 2)) {
+      throw string("Invalid en passant square '") + en_passant + "'";
+    }
+    game.en_passant = get_square(en_passant);
+  }
+  game.halfmove_clock = halfmove_clock;
+  game.fullmove_number = fullmove_number;
+  game.hash = hash_game(game);
+  game.starting_fen = fen;
+  game.threats = find_threats(game.board, game.turn);
+  return game;
+}
@@ -0,0 +1,958 @@
+#pragma once
+
+/**
+ * Board representation and rules of chess: pieces, squares and bitboards,
+ * attack tables, legal move generation, making and taking back moves, and
+ * reading and writing FEN and Standard Algebraic Notation.
+ */
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "inline_list.h"
+#include "stats.h"
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+constexpr uint8_t uint8(uint8_t n) {
+  return n;
+}
+
+enum Color : bool {
+  white = true,
+  black = false,
+};
+
+// Overloading operator! to return Color instead of bool leads to segfault
+constexpr Color invert(const Color color) {
+  return static_cast<Color>(!color);
+}
+
+enum Piece : uint8_t {
+  PAWN,
+  KNIGHT,
+  BISHOP,
+  ROOK,
+  QUEEN,
+  KING,
+};
+constexpr std::array<Piece, 6> PIECE_TYPES = {
+    PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING};
+
+struct ColorPiece {
+  Color color;
+  Piece piece;
+
+  constexpr bool operator==(const ColorPiece &other) const {
+    return color == other.color && piece == other.piece;
+  }
+};
+
+constexpr ColorPiece invert(ColorPiece piece) {
+  piece.color = invert(piece.color);
+  return piece;
+}
+
+/** Symbols by piece and color, White's filled for dark terminals */
+constexpr std::array<std::array<std::string_view, 2>, 6> UTF8_PIECES = {
+    {
+        {"♙", "♟︎"},
+        {"♘", "♞"},
+        {"♗", "♝"},
+        {"♖", "♜"},
+        {"♕", "♛"},
+        {"♔", "♚"},
+    },
+};
+
+std::string to_string(const ColorPiece &piece);
+
+constexpr ColorPiece WHITE_PAWN = {white, PAWN};
+constexpr ColorPiece WHITE_KNIGHT = {white, KNIGHT};
+constexpr ColorPiece WHITE_BISHOP = {white, BISHOP};
+constexpr ColorPiece WHITE_ROOK = {white, ROOK};
+constexpr ColorPiece WHITE_QUEEN = {white, QUEEN};
+constexpr ColorPiece WHITE_KING = {white, KING};
+constexpr ColorPiece BLACK_PAWN = {black, PAWN};
+constexpr ColorPiece BLACK_KNIGHT = {black, KNIGHT};
+constexpr ColorPiece BLACK_BISHOP = {black, BISHOP};
+constexpr ColorPiece BLACK_ROOK = {black, ROOK};
+constexpr ColorPiece BLACK_QUEEN = {black, QUEEN};
+constexpr ColorPiece BLACK_KING = {black, KING};
+
+struct Square {
+  uint8_t file;
+  uint8_t rank;
+
+  constexpr bool operator==(const Square &other) const {
+    return file == other.file && rank == other.rank;
+  }
+
+  constexpr bool exists() const {
+    return file <= 7 && rank <= 7;  // always >= 0 due to unsinged
+  }
+
+  /** Bit index on a Bitboard: a1 = 0, h1 = 7, a8 = 56, h8 = 63 */
+  constexpr uint8_t index() const {
+    return rank * 8 + file;
+  }
+};
+
+constexpr Square get_square(const uint8_t index) {
+  return Square{uint8(index % 8), uint8(index / 8)};
+}
+
+std::string to_string(const Square &square);
+
+constexpr Square get_square(const char file, const char rank) {
+  return Square{uint8((file - 'a')), uint8((rank - '1'))};
+}
+
+Square get_square(const std::string &square);
+
+
+typedef uint64_t Bitboard;
+
+constexpr Bitboard FILE_A = 0x0101010101010101;
+constexpr Bitboard RANK_1 = 0xff;
+
+constexpr Bitboard square_mask(const uint8_t index) {
+  return Bitboard{1} << index;
+}
+
+constexpr Bitboard square_mask(const Square &square) {
+  return square_mask(square.index());
+}
+
+/** Remove the lowest set bit from a Bitboard and return its index. */
+constexpr uint8_t pop_square(Bitboard &bitboard) {
+  const uint8_t index = std::countr_zero(bitboard);
+  bitboard &= bitboard - 1;
+  return index;
+}
+
+/** Room for every square, so any Bitboard fits */
+using SquareList = InlineList<Square, 64>;
+
+SquareList to_squares(Bitboard bitboard);
+
+/**
+ * Position of all pieces as one 64 bit mask per piece type and per color.
+ * The mailbox mirrors the masks so looking up a single square does not have
+ * to test all of them.
+ */
+struct Board {
+  std::array<Bitboard, 6> pieces = {};
+  std::array<Bitboard, 2> colors = {};
+  Bitboard occupied = 0;
+  std::array<std::optional<ColorPiece>, 64> mailbox = {};
+
+  constexpr Bitboard of(const ColorPiece &piece) const {
+    return pieces[piece.piece] & colors[piece.color];
+  }
+
+  constexpr void put(const Square &square, const ColorPiece &piece) {
+    const Bitboard mask = square_mask(square);
+    pieces[piece.piece] |= mask;
+    colors[piece.color] |= mask;
+    occupied |= mask;
+    mailbox[square.index()] = piece;
+  }
+
+  constexpr void remove(const Square &square) {
+    const std::optional<ColorPiece> &piece = mailbox[square.index()];
+    if (piece) {
+      const Bitboard mask = ~square_mask(square);
+      pieces[piece->piece] &= mask;
+      colors[piece->color] &= mask;
+      occupied &= mask;
+      mailbox[square.index()] = std::nullopt;
+    }
+  }
+};
+
+// clang-format off
+constexpr std::array<std::array<std::optional<ColorPiece>, 8>, 8> STARTING_SETUP = {{
+  {WHITE_ROOK,   WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_ROOK},
+  {WHITE_KNIGHT, WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_KNIGHT},
+  {WHITE_BISHOP, WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_BISHOP},
+  {WHITE_QUEEN,  WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_QUEEN},
+  {WHITE_KING,   WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_KING},
+  {WHITE_BISHOP, WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_BISHOP},
+  {WHITE_KNIGHT, WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_KNIGHT},
+  {WHITE_ROOK,   WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_ROOK},
+}};
+// clang-format on
+
+constexpr Board STARTING_BOARD = [] {
+  Board board;
+  for (uint8_t file = 0; file < 8; ++file) {
+    for (uint8_t rank = 0; rank < 8; ++rank) {
+      if (STARTING_SETUP[file][rank]) {
+        board.put({file, rank}, *STARTING_SETUP[file][rank]);
+      }
+    }
+  }
+  return board;
+}();
+
+/**
+ * Zobrist keys: a position's hash is the XOR of one random key per piece on
+ * its square plus keys for side to move, castling rights and en passant file,
+ * so a move only needs to toggle the keys of what it changed.
+ */
+struct ZobristKeys {
+  std::array<std::array<std::array<uint64_t, 64>, 6>, 2> pieces;
+  /** [color][0 = king side, 1 = queen side] */
+  std::array<std::array<uint64_t, 2>, 2> castling;
+  std::array<uint64_t, 8> en_passant;
+  uint64_t black_to_move;
+};
+
+constexpr ZobristKeys ZOBRIST = [] {
+  uint64_t state = 0x243f6a8885a308d3;  // fixed seed, keys must be reproducible
+  const auto next = [&state] {  // splitmix64
+    uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  };
+  ZobristKeys keys;
+  for (auto &color : keys.pieces) {
+    for (auto &piece : color) {
+      for (uint64_t &key : piece) {
+        key = next();
+      }
+    }
+  }
+  for (auto &color : keys.castling) {
+    for (uint64_t &key : color) {
+      key = next();
+    }
+  }
+  for (uint64_t &key : keys.en_passant) {
+    key = next();
+  }
+  keys.black_to_move = next();
+  return keys;
+}();
+
+constexpr uint64_t hash_pieces(const Board &board) {
+  uint64_t hash = 0;
+  for (uint8_t index = 0; index < 64; ++index) {
+    if (const std::optional<ColorPiece> &piece = board.mailbox[index]) {
+      hash ^= ZOBRIST.pieces[piece->color][piece->piece][index];
+    }
+  }
+  return hash;
+}
+
+constexpr uint64_t STARTING_HASH = hash_pieces(STARTING_BOARD)
+                                   ^ ZOBRIST.castling[white][0]
+                                   ^ ZOBRIST.castling[white][1]
+                                   ^ ZOBRIST.castling[black][0]
+                                   ^ ZOBRIST.castling[black][1];
+
+/**
+ * A move packed into 16 bits: origin and target square with 6 bits each,
+ * the promoted piece and a flag for the moves that need special treatment.
+ * Everything else, like the moving or captured piece, follows from the
+ * position the move is played in.
+ */
+struct Move {
+  enum Flag : uint8_t { NORMAL, PROMOTION, EN_PASSANT, CASTLING };
+
+  uint16_t data = 0;
+
+  constexpr Move() = default;
+
+  constexpr Move(
+      const Square &from,
+      const Square &to,
+      const Flag flag = NORMAL,
+      const Piece promotion = KNIGHT
+  )
+      : data(
+          from.index() | to.index() << 6 | (promotion - KNIGHT) << 12
+          | flag << 14
+      ) {}
+
+  constexpr Square from() const {
+    return get_square(uint8(data & 0x3f));
+  }
+
+  constexpr Square to() const {
+    return get_square(uint8(data >> 6 & 0x3f));
+  }
+
+  constexpr Flag flag() const {
+    return static_cast<Flag>(data >> 14);
+  }
+
+  constexpr std::optional<Piece> promotion() const {
+    if (flag() == PROMOTION) {
+      return static_cast<Piece>(KNIGHT + (data >> 12 & 0b11));
+    }
+    return std::nullopt;
+  }
+
+  constexpr bool operator==(const Move &other) const {
+    return data == other.data;
+  }
+};
+static_assert(sizeof(Move) == 2);
+
+/** The most legal moves known in a position is 218 */
+using MoveList = InlineList<Move, 256>;
+
+/**
+ * What move generation needs to know about the side to move's King. apply_move
+ * finds it with a few table lookups from the King's square; which squares the
+ * opponent attacks is only worked out for the squares the King wants to go to.
+ */
+struct Threats {
+  /** Pieces giving check to the side to move */
+  Bitboard checkers;
+  /** Pieces of the side to move that shield their King from a slider */
+  Bitboard pinned;
+};
+
+Threats find_threats(const Board &board, Color turn);
+
+/** Neurons of the first layer per perspective */
+constexpr size_t NNUE_HIDDEN = 128;
+
+/** Evaluation network, see nnue.h */
+struct Network;
+
+/** First layer sums of a position from White's and from Black's view */
+struct Accumulator {
+  alignas(64) std::array<std::array<int16_t, NNUE_HIDDEN>, 2> values;
+};
+
+struct Game {
+  Board board = STARTING_BOARD;
+  std::vector<Move> history = {};
+  Color turn = white;
+
+  struct CanCastle {
+    bool king_side;
+    bool queen_side;
+  };
+  std::array<CanCastle, 2> can_castle = {{{true, true}, {true, true}}};
+
+  /** Square skipped by a pawn that just advanced two ranks */
+  std::optional<Square> en_passant = std::nullopt;
+
+  /** Plies since the last capture or pawn move, for the fifty-move rule */
+  uint16_t halfmove_clock = 0;
+  /** Starts at 1 and counts up after each of Black's moves, as in FEN */
+  uint16_t fullmove_number = 1;
+
+  /** Zobrist key of the current position, updated by apply_move */
+  uint64_t hash = STARTING_HASH;
+  /** Keys of all earlier positions, oldest first */
+  std::vector<uint64_t> previous_hashes = {};
+
+  /** Position before the first move of the history, empty for the default */
+  std::string starting_fen = "";
+
+  Threats threats = find_threats(STARTING_BOARD, white);
+
+  /** Evaluation network if one was loaded, updated by apply_move */
+  const Network *network = nullptr;
+  Accumulator accumulator = {};
+
+  /** Counts copies when statistics are compiled in, takes no space */
+  [[no_unique_address]] CopyCounter<GAME_COPIES> copies = {};
+};
+
+/** Evaluate the game with the given network from now on */
+void attach_network(Game &game, const Network *network);
+
+constexpr ColorPiece get_piece(const char piece_character, const Color color) {
+  switch (piece_character) {
+    case 'K':
+      return {color, KING};
+    case 'Q':
+      return {color, QUEEN};
+    case 'R':
+      return {color, ROOK};
+    case 'B':
+      return {color, BISHOP};
+    case 'N':
+      return {color, KNIGHT};
+    case 'P':
+      return {color, PAWN};
+    default:
+      throw std::string("Invalid piece '") + piece_character + "'";
+  }
+}
+
+constexpr std::optional<ColorPiece> get_piece(
+    const Board &board, const Square &square
+) {
+  return board.mailbox[square.index()];
+}
+
+SquareList find_pieces(const Board &board, const ColorPiece &piece);
+
+
+/* Attack tables
+ *
+ * Non-sliding pieces use one precomputed mask per square. Bishops and rooks
+ * use "fancy" magic bitboards: the relevant blockers on a square's rays are
+ * hashed by multiplication into a dense table of attack masks. With BMI2 the
+ * hash is replaced by a PEXT of the same bits, using the same tables.
+ *
+ * The compiler computes all tables, so nothing is initialised at startup.
+ * Lookups are specialised by piece type through templates, the hot paths
+ * never dispatch on the piece at run time.
+ */
+
+constexpr std::array<std::pair<int8_t, int8_t>, 8> KNIGHT_STEPS = {
+    {{+1, +2}, {+1, -2}, {-1, +2}, {-1, -2}, {+2, +1}, {+2, -1}, {-2, +1}, {-2, -1}}
+};
+constexpr std::array<std::pair<int8_t, int8_t>, 8> KING_STEPS = {
+    {{-1, -1}, {+1, -1}, {-1, +1}, {+1, +1}, {0, -1}, {0, +1}, {-1, 0}, {+1, 0}}
+};
+
+// Generated offline with a fixed seed, see "fancy magic bitboards".
+// clang-format off
+constexpr std::array<Bitboard, 64> ROOK_MAGIC_NUMBERS = {
+    0x1080004008801020, 0x0840092002c03000, 0x1900200010400900, 0x0880100008000480,
+    0x4200100420080200, 0x8100020100080400, 0x0200040110886200, 0x0200008040220411,
+    0x0404800084400220, 0x0000401000402000, 0x0086001081220440, 0x0408800800100280,
+    0x000a001201040820, 0x8848800200840080, 0x4001000100040200, 0x0442000102105084,
+    0x9080010020804100, 0x0040404000201009, 0x0000808010002009, 0x2200090021d00100,
+    0x0008008008040080, 0x0004004002010040, 0x0011040008015042, 0x00000a0001768104,
+    0x0000800080204009, 0x2010004140002001, 0x9800200280100080, 0x1000100080080080,
+    0x0442000a00049020, 0x2100040080020080, 0x0800120400900148, 0x0010040a00128541,
+    0x2800804000800030, 0x1010002000400041, 0x4000200011004100, 0x0610008410800800,
+    0x0400802402800800, 0xc100020080800400, 0x0002000802000401, 0x0182085882000401,
+    0x0220204000808000, 0x2860100040024022, 0x0001002004110040, 0x99101042000a0020,
+    0x0004080004008080, 0x0010040002008080, 0x2012004881020004, 0x8300842444820011,
+    0x0088403882010200, 0x0820400080210100, 0x0110910040a00300, 0x0801100280080480,
+    0x0242009008200600, 0x1002000489500200, 0x0040800200010080, 0x0091800041000080,
+    0x0000209300488001, 0x04c1002414824001, 0x020020000b001041, 0x7000100004200901,
+    0x8002002004100802, 0x30010002084c0007, 0x0888221800813004, 0x4000002840840112,
+};
+constexpr std::array<Bitboard, 64> BISHOP_MAGIC_NUMBERS = {
+    0xa010041108003100, 0x006082020a002900, 0x6810010619200000, 0x08281a0520000408,
+    0x0001104001000400, 0x0018901008048400, 0x00040a0210245280, 0x000200210808a402,
+    0x9140048410821200, 0x0800091010820041, 0x20504804832202c0, 0x0100091401081000,
+    0x8021011140000012, 0x0810020804450400, 0x208b0542109008a2, 0x0080084a08040204,
+    0x0040e2a80811244c, 0x2505022008008108, 0x0430220100420040, 0x010a040420220040,
+    0x1105000290400000, 0x0093001200822120, 0x4000a62048043004, 0x280120048a015004,
+    0x006090002a020814, 0x44042000240800d0, 0x01102800040a4400, 0x1004080080220040,
+    0x0001001011004024, 0x0010044000805040, 0x0914041200820100, 0x0004821012821480,
+    0x0024040500c05021, 0x0088611002080200, 0x0116080a00040020, 0x4000020080080080,
+    0x2450450140840040, 0x0000880201484100, 0x0222020404020092, 0x8081110600002e00,
+    0x2842101105000801, 0x1100809008001025, 0x00020202221c0400, 0x0422014022009020,
+    0x0210046102100c00, 0xc004008082029102, 0x00aa461801101200, 0x0404080080201108,
+    0x020542108c205002, 0x0410544804100100, 0x0040910841100000, 0x0400200042021100,
+    0x00004204850400c0, 0x0200100410a42102, 0x1040020801210102, 0x0805040410420000,
+    0x2884804130100200, 0x800c262201242000, 0x1058000194108800, 0x0014221054420204,
+    0x0104000012a02200, 0x0200881003300100, 0x0140400202840100, 0x0402020801010201,
+};
+// clang-format on
+
+struct Magic {
+  Bitboard mask;
+  Bitboard magic;
+  uint32_t offset;
+  uint8_t shift;
+
+#ifdef __BMI2__
+  static constexpr bool PEXT = true;
+#else
+  static constexpr bool PEXT = false;
+#endif
+
+  constexpr uint32_t index(const Bitboard occupied) const {
+#ifdef __BMI2__
+    if (!std::is_constant_evaluated()) {
+      return offset + _pext_u64(occupied, mask);
+    }
+    // PEXT by hand, for the static_asserts
+    uint32_t index = 0;
+    uint32_t bit = 1;
+    for (Bitboard bits = mask; bits; bits &= bits - 1, bit <<= 1) {
+      index |= occupied & bits & -bits ? bit : 0;
+    }
+    return offset + index;
+#else
+    return offset + (((occupied & mask) * magic) >> shift);
+#endif
+  }
+};
+
+template <size_t N>
+constexpr Bitboard step_attacks(
+    const Square &square, const std::array<std::pair<int8_t, int8_t>, N> &steps
+) {
+  Bitboard attacks = 0;
+  for (const auto &[d_file, d_rank] : steps) {
+    const Square target = {
+        uint8(square.file + d_file), uint8(square.rank + d_rank)};
+    if (target.exists()) {
+      attacks |= square_mask(target);
+    }
+  }
+  return attacks;
+}
+
+/** Rook directions first, then bishop directions, opposite ones side by side */
+constexpr std::array<std::pair<int8_t, int8_t>, 8> RAY_DIRECTIONS = {
+    {{0, -1}, {0, +1}, {-1, 0}, {+1, 0}, {-1, -1}, {+1, +1}, {+1, -1}, {-1, +1}}
+};
+
+/** Squares from a square to the edge in each of RAY_DIRECTIONS */
+constexpr std::array<std::array<Bitboard, 64>, 8> RAYS = [] {
+  std::array<std::array<Bitboard, 64>, 8> rays = {};
+  for (uint8_t direction = 0; direction < 8; ++direction) {
+    const auto [d_file, d_rank] = RAY_DIRECTIONS[direction];
+    for (uint8_t index = 0; index < 64; ++index) {
+      Bitboard ray = 0;
+      for (Square target = get_square(index);;) {
+        target = {uint8(target.file + d_file), uint8(target.rank + d_rank)};
+        if (!target.exists()) {
+          break;
+        }
+        ray |= square_mask(target);
+      }
+      rays[direction][index] = ray;
+    }
+  }
+  return rays;
+}();
+
+/**
+ * Squares a slider on the given square reaches along a file or diagonal
+ * (without the square itself) up to and including the first blocker each
+ * way: subtracting twice the slider from the blockers carries up to the next
+ * one ("hyperbola quintessence"), and the same on the byte-swapped board
+ * gives the other way.
+ */
+constexpr Bitboard line_attacks(
+    const uint8_t square, const Bitboard line, const Bitboard occupied
+) {
+  const Bitboard slider = square_mask(square);
+  const Bitboard blockers = occupied & line;
+  const Bitboard up = blockers - 2 * slider;
+  const Bitboard down =
+      __builtin_bswap64(__builtin_bswap64(blockers) - 2 * __builtin_bswap64(slider));
+  return (up ^ down) & line;
+}
+
+/**
+ * Squares a rook on each file of a rank attacks along it, by the blockers on
+ * the six inner files
+ */
+constexpr std::array<std::array<uint8_t, 64>, 8> RANK_ATTACKS = [] {
+  std::array<std::array<uint8_t, 64>, 8> attacks = {};
+  for (uint8_t file = 0; file < 8; ++file) {
+    for (uint8_t inner = 0; inner < 64; ++inner) {
+      const uint8_t blockers = inner << 1;
+      uint8_t attacked = 0;
+      for (int8_t to = file + 1; to < 8; ++to) {
+        attacked |= 1 << to;
+        if (blockers >> to & 1) {
+          break;
+        }
+      }
+      for (int8_t to = file - 1; to >= 0; --to) {
+        attacked |= 1 << to;
+        if (blockers >> to & 1) {
+          break;
+        }
+      }
+      attacks[file][inner] = attacked;
+    }
+  }
+  return attacks;
+}();
+
+/** Slider attacks computed without lookup tables, to build them */
+constexpr Bitboard slide(const uint8_t square, const bool rook, const Bitboard occupied) {
+  if (rook) {
+    return line_attacks(square, (FILE_A << (square & 7)) ^ square_mask(square), occupied)
+           | Bitboard(RANK_ATTACKS[square & 7][occupied >> (square & 56) >> 1 & 63])
+                 << (square & 56);
+  }
+  return line_attacks(square, RAYS[4][square] | RAYS[5][square], occupied)
+         | line_attacks(square, RAYS[6][square] | RAYS[7][square], occupied);
+}
+
+/**
+ * All attack tables. They are computed by the compiler (see ATTACKS in
+ * board.cpp), so the program starts with them in read-only data.
+ */
+struct AttackTables {
+  std::array<Bitboard, 64> knight;
+  std::array<Bitboard, 64> king;
+  std::array<std::array<Bitboard, 64>, 2> pawn;
+  std::array<Magic, 64> bishop_magics;
+  std::array<Magic, 64> rook_magics;
+  std::array<Bitboard, 5248> bishop;
+  std::array<Bitboard, 102400> rook;
+  /** Squares strictly between two squares on a common line, if any */
+  std::array<std::array<Bitboard, 64>, 64> between;
+  /** Whole board-spanning line through two squares, if any */
+  std::array<std::array<Bitboard, 64>, 64> line;
+};
+
+extern const AttackTables ATTACKS;
+
+inline Bitboard bishop_attacks(const uint8_t square, const Bitboard occupied) {
+  return ATTACKS.bishop[ATTACKS.bishop_magics[square].index(occupied)];
+}
+
+inline Bitboard rook_attacks(const uint8_t square, const Bitboard occupied) {
+  return ATTACKS.rook[ATTACKS.rook_magics[square].index(occupied)];
+}
+
+/**
+ * Squares attacked by a piece of the given type standing on the given square,
+ * resolved at compile time. For pawns only the diagonal captures are
+ * included, seen from the given color.
+ */
+template <Piece piece, Color color = white>
+inline Bitboard attacks(const uint8_t square, const Bitboard occupied) {
+  if constexpr (piece == PAWN) {
+    return ATTACKS.pawn[color][square];
+  } else if constexpr (piece == KNIGHT) {
+    return ATTACKS.knight[square];
+  } else if constexpr (piece == BISHOP) {
+    return bishop_attacks(square, occupied);
+  } else if constexpr (piece == ROOK) {
+    return rook_attacks(square, occupied);
+  } else if constexpr (piece == QUEEN) {
+    return bishop_attacks(square, occupied) | rook_attacks(square, occupied);
+  } else {
+    static_assert(piece == KING);
+    return ATTACKS.king[square];
+  }
+}
+
+/** The same for a piece only known at run time */
+inline Bitboard attacks(
+    const ColorPiece &piece, const uint8_t square, const Bitboard occupied
+) {
+  switch (piece.piece) {
+    case PAWN:
+      return piece.color ? attacks<PAWN, white>(square, occupied)
+                         : attacks<PAWN, black>(square, occupied);
+    case KNIGHT:
+      return attacks<KNIGHT>(square, occupied);
+    case BISHOP:
+      return attacks<BISHOP>(square, occupied);
+    case ROOK:
+      return attacks<ROOK>(square, occupied);
+    case QUEEN:
+      return attacks<QUEEN>(square, occupied);
+    case KING:
+      return attacks<KING>(square, occupied);
+    default:
+      throw std::string("Unknown piece code " + std::to_string(piece.piece));
+  }
+}
+
+/** All pieces of the given color that attack a square. */
+inline Bitboard attackers(
+    const Board &board,
+    const uint8_t square,
+    const Color by_color,
+    const Bitboard occupied
+) {
+  const Bitboard diagonal = board.pieces[BISHOP] | board.pieces[QUEEN];
+  const Bitboard straight = board.pieces[ROOK] | board.pieces[QUEEN];
+  return board.colors[by_color]
+         & ((ATTACKS.pawn[invert(by_color)][square] & board.pieces[PAWN])
+            | (ATTACKS.knight[square] & board.pieces[KNIGHT])
+            | (ATTACKS.king[square] & board.pieces[KING])
+            | (bishop_attacks(square, occupied) & diagonal)
+            | (rook_attacks(square, occupied) & straight));
+}
+
+SquareList find_attacking_pieces(
+    const Board &board,
+    const Square &target_square,
+    const ColorPiece &piece,
+    const std::optional<uint8_t> file = std::nullopt,
+    const std::optional<uint8_t> rank = std::nullopt
+);
+
+inline bool is_attacked(
+    const Board &board, const Square &square, const Color by_color
+) {
+  count_stat(IS_ATTACKED);
+  return attackers(board, square.index(), by_color, board.occupied) != 0;
+}
+
+/** Squares attacked by all pieces of one color */
+Bitboard attacked_squares(const Board &board, const Color color);
+
+bool is_in_check(const Game &game, Color color);
+
+/** Syntactic content of a move in Standard Algebraic Notation (SAN) */
+struct SanMove {
+  enum Castling : uint8_t { NONE, KING_SIDE, QUEEN_SIDE };
+
+  Piece piece = PAWN;
+  Square to = {0, 0};
+  std::optional<uint8_t> from_file = std::nullopt;
+  std::optional<uint8_t> from_rank = std::nullopt;
+  bool capture = false;
+  std::optional<Piece> promotion = std::nullopt;
+  Castling castling = NONE;
+};
+
+constexpr std::optional<Piece> get_piece_type(const char piece_character) {
+  switch (piece_character) {
+    case 'N':
+      return KNIGHT;
+    case 'B':
+      return BISHOP;
+    case 'R':
+      return ROOK;
+    case 'Q':
+      return QUEEN;
+    case 'K':
+      return KING;
+    default:
+      return std::nullopt;
+  }
+}
+
+/**
+ * Split a SAN move like "Nbxd7+", "exd8=Q#" or "O-O-O" into its parts in a
+ * single pass without allocating. Trailing check, mate and annotation symbols
+ * (+ # ! ?) are accepted and ignored. Returns nothing if the text does not
+ * have the shape of a move – whether it is legal is up to decode_move.
+ *
+ * TODO shortened pawn captures ("exd", "ed")
+ */
+constexpr std::optional<SanMove> parse_san(std::string_view san) {
+  while (!san.empty() && std::string_view("+#!?").find(san.back()) != san.npos) {
+    san.remove_suffix(1);
+  }
+  if (san.empty()) {
+    return std::nullopt;
+  }
+  SanMove mv;
+
+  if (san[0] == 'O' || san[0] == 'o' || san[0] == '0') {
+    // "O-O", "O-O-O", also "0-0", "OO", "o-o-o"
+    uint8_t castles = 0;
+    for (size_t i = 0; i < san.size(); ++i) {
+      const char c = san[i];
+      if (c == 'O' || c == 'o' || c == '0') {
+        ++castles;
+      } else if (c != '-' || i == 0 || san[i - 1] == '-') {
+        return std::nullopt;
+      }
+    }
+    if (san.back() == '-' || castles < 2 || castles > 3) {
+      return std::nullopt;
+    }
+    mv.piece = KING;
+    mv.castling = castles == 3 ? SanMove::QUEEN_SIDE : SanMove::KING_SIDE;
+    return mv;
+  }
+
+  if (const std::optional<Piece> piece = get_piece_type(san[0])) {
+    mv.piece = *piece;
+    san.remove_prefix(1);
+  }
+
+  if (mv.piece == PAWN && !san.empty()) {
+    if (const std::optional<Piece> promotion = get_piece_type(san.back());
+        promotion && promotion != KING) {
+      mv.promotion = promotion;
+      san.remove_suffix(1);
+      if (!san.empty() && san.back() == '=') {
+        san.remove_suffix(1);
+      }
+    }
+  }
+
+  const auto is_file = [](const char c) { return 'a' <= c && c <= 'h'; };
+  const auto is_rank = [](const char c) { return '1' <= c && c <= '8'; };
+
+  if (san.size() < 2 || !is_file(san[san.size() - 2]) || !is_rank(san.back())) {
+    return std::nullopt;
+  }
+  mv.to = get_square(san[san.size() - 2], san.back());
+  san.remove_suffix(2);
+
+  if (!san.empty() && (san.back() == 'x' || san.back() == ':')) {
+    mv.capture = true;
+    san.remove_suffix(1);
+  }
+  if (!san.empty() && is_file(san[0])) {
+    mv.from_file = san[0] - 'a';
+    san.remove_prefix(1);
+  }
+  if (!san.empty() && is_rank(san[0])) {
+    mv.from_rank = san[0] - '1';
+    san.remove_prefix(1);
+  }
+  if (!san.empty()) {
+    return std::nullopt;
+  }
+
+  if (mv.piece == PAWN
+      && (mv.from_rank || mv.capture != mv.from_file.has_value())) {
+    return std::nullopt;  // "e4" or "dxe5", but not "de5" or "xe5"
+  }
+  return mv;
+}
+
+constexpr Move::Flag get_promotion(
+    const Square &to, const Color color, const std::optional<Piece> promotion
+) {
+  const bool must_promote = color == white && to.rank == 7
+                            || color == black && to.rank == 0;
+  if (must_promote && !promotion) {
+    throw std::string("The pawn reaches the final rank and must be promoted.");
+  } else if (!must_promote && promotion) {
+    throw std::string("Can only promote on the final rank.");
+  }
+  return promotion ? Move::PROMOTION : Move::NORMAL;
+}
+
+/**
+ * Extract all relevant details from a move given in algebraic notation on a
+ * specific board and check if it is legal to apply.
+ */
+Move decode_move(const Game &game, const std::string_view move);
+
+uint64_t hash_castling(const std::array<Game::CanCastle, 2> &can_castle);
+
+/**
+ * The en passant file only counts as part of the position if the side to move
+ * has a pawn next to the skipped square. Otherwise transpositions with and
+ * without a double step would not be recognised as the same position.
+ */
+uint64_t hash_en_passant(const Game &game);
+
+/** Calculate a position's Zobrist key from scratch. */
+uint64_t hash_game(const Game &game);
+
+/** Everything apply_move overwrites that undo_move can't derive from the move */
+struct Undo {
+  std::optional<ColorPiece> capture;
+  std::array<Game::CanCastle, 2> can_castle;
+  std::optional<Square> en_passant;
+  uint16_t halfmove_clock;
+  uint64_t hash;
+  Threats threats;
+};
+
+/**
+ * Execute a decoded move on the given board. This function assumes that all
+ * checks have passed and that it can be applied to the given board to create a
+ * valid game state. The returned record allows taking the move back.
+ */
+Undo apply_move(Game &game, const Move &move);
+
+/** Take back the last move, which must have been applied with this record. */
+void undo_move(Game &game, const Move &move, const Undo &undo);
+
+/**
+ * A position repeated for the third time with the same side to move allows
+ * either player to claim a draw.
+ */
+bool is_threefold_repetition(const Game &game);
+
+/**
+ * Only the Kings and at most one Knight or Bishop in total are left, so
+ * nobody can mate. Other endings without pawns, like a Knight against a
+ * Bishop, still allow a mate and are played out.
+ */
+bool is_insufficient_material(const Board &board);
+
+/**
+ * Add a move to the list, expanding pawn moves onto the final rank into all
+ * four promotions.
+ */
+void add_moves(
+    MoveList &moves, const Piece piece, const uint8_t from, Bitboard targets
+);
+
+/**
+ * Which of the legal moves to generate. Captures include en passant and all
+ * promotions; quiet moves are the rest, including castling. Together they
+ * are all moves, so a search can generate the quiet ones only when the
+ * captures didn't settle a position.
+ */
+enum class MoveSelection : uint8_t { ALL, CAPTURES, QUIETS };
+
+/**
+ * List all legal moves for the side to move, or only the selected kind.
+ *
+ * Moves are generated strictly legal instead of being tried and taken back:
+ * a king in check only allows moves that capture or block the checker, and
+ * pinned pieces may only move along the line to their king.
+ *
+ * The list is cleared first, so a search can reuse one per ply.
+ */
+void generate_moves(
+    const Game &game, MoveList &moves, MoveSelection selection = MoveSelection::ALL
+);
+
+MoveList generate_moves(const Game &game);
+
+/**
+ * Whether the side to move can still move at all. Without check, a King with
+ * a free square that is not attacked settles it; only otherwise the moves are
+ * generated.
+ */
+bool has_legal_moves(const Game &game);
+
+/**
+ * Whether generate_moves would list the move, e.g. one remembered from
+ * another position by a transposition table. Only the one move is checked,
+ * by the same rules, so nothing is generated.
+ */
+bool is_legal(const Game &game, const Move &move);
+
+bool is_checkmate(const Game &game);
+
+bool is_stalemate(const Game &game);
+
+/**
+ * Standard Algebraic Notation of a legal move, e.g. "Nbd7", "exd8=Q+" or
+ * "O-O#". The move is applied and taken back to determine check and mate,
+ * so the game is left unchanged.
+ */
+std::string encode_move(Game &game, const Move &move);
+
+/** Coordinate notation as used by perft tools, e.g. "e2e4" or "e7e8q" */
+std::string to_long_algebraic(const Move &move);
+
+constexpr char STARTING_FEN[] =
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+/**
+ * Set up a game from Forsyth–Edwards Notation. The move counters are
+ * optional and default to 0 and 1. An en passant square must be on the
+ * sixth rank with White to move or on the third with Black to move.
+ * Positions with Pawns on the first or last rank, or with the side that just
+ * moved in check, are rejected. Castling rights are dropped when the King or
+ * that Rook isn't on its starting square.
+ */
+Game parse_fen(const std::string &fen);
+/** Forsyth-Edwards Notation of the position, the inverse of parse_fen */
+std::string to_fen(const Game &game);
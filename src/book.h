@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "board.h"
+#include "mapped_file.h"
+
+/**
+ * Move in Polyglot notation: to, from and promotion with 3 bits per file,
+ * rank and piece. Castling is written as the King capturing his Rook.
+ */
+uint16_t to_polyglot(const Move &move);
+
+/**
+ * The position's key in Polyglot books: the Random64 entries of every piece
+ * on its square, of each castling right, of the en passant file if a pawn of
+ * the side to move stands next to the pawn that just moved, and of White to
+ * move, all XORed together.
+ */
+uint64_t polyglot_key(const Game &game);
+
+/**
+ * Opening book in the Polyglot format: 16 byte entries of key, move, weight
+ * and learning data as big-endian integers, sorted by key. The file is
+ * mapped, so opening even a huge book is instant and its pages are shared
+ * between processes. Positions are looked up by their Polyglot key, so
+ * books made by other Polyglot tools work as well.
+ */
+class Book {
+  static constexpr size_t ENTRY_SIZE = 16;
+
+  MappedFile file;
+
+  struct Entry {
+    uint64_t key;
+    uint16_t move;
+    uint16_t weight;
+  };
+
+  template <typename T> T read(const size_t offset) const {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      value = value << 8 | static_cast<uint8_t>(file.view()[offset + i]);
+    }
+    return value;
+  }
+
+  size_t size() const {
+    return file.view().size() / ENTRY_SIZE;
+  }
+
+  Entry entry(const size_t index) const {
+    const size_t offset = index * ENTRY_SIZE;
+    return {read<uint64_t>(offset), read<uint16_t>(offset + 8), read<uint16_t>(offset + 10)};
+  }
+
+ public:
+  explicit Book(const std::string &path) : file(path) {
+    if (file.view().size() % ENTRY_SIZE) {
+      throw path + " is not a Polyglot book.";
+    }
+  }
+
+  /** Legal book moves of the position with their weights, best first */
+  std::vector<std::pair<Move, uint16_t>> lookup(const Game &game) const {
+    const uint64_t key = polyglot_key(game);
+    size_t low = 0, high = size();
+    while (low < high) {
+      const size_t middle = (low + high) / 2;
+      if (entry(middle).key < key) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    std::vector<std::pair<Move, uint16_t>> moves;
+    const MoveList legal = generate_moves(game);
+    for (size_t i = low; i < size() && entry(i).key == key; ++i) {
+      const Entry found = entry(i);
+      for (const Move &move : legal) {
+        if (to_polyglot(move) == found.move) {
+          moves.emplace_back(move, found.weight);
+        }
+      }
+    }
+    std::ranges::stable_sort(moves, std::greater(), &std::pair<Move, uint16_t>::second);
+    return moves;
+  }
+
+  /** Pick one of the moves at random, in proportion to their weights */
+  static std::optional<Move> choose(
+      const std::vector<std::pair<Move, uint16_t>> &moves, std::mt19937 &random
+  ) {
+    uint32_t total = 0;
+    for (const auto &[move, weight] : moves) {
+      total += weight;
+    }
+    if (total == 0) {
+      return std::nullopt;
+    }
+    uint32_t pick = random() % total;
+    for (const auto &[move, weight] : moves) {
+      if (pick < weight) {
+        return move;
+      }
+      pick -= weight;
+    }
+    return std::nullopt;
+  }
+};
+
+/**
+ * Write a book of the moves played in the first plies of every valid game
+ * of a PGN file, weighted by how often they were played.
+ */
+void build_book(const std::string &pgn_path, const std::string &book_path, size_t plies);
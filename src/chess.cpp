@@ -1,13 +1,34 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
 #include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
-#include <map>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <ranges>
+#include <random>
 #include <regex>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "chesscore.h"
+#include "mapped_file.h"
+#include "server.h"
+
 using namespace std;
 
 /**
@@ -23,638 +44,1091 @@ constexpr char HELP_TEXT[] =
      "Type 'help' or '?' to view this text.\n"
      "Type 'quit' or ctrl+d to exit.\n"
      "Type 'restart'  (or 'res') to start a new game.\n"
-     "Type 'history' (or 'hist') to view a list of previous moves.\n");
-
-constexpr uint8_t uint8(uint8_t n) {
-  return n;
-}
-
-enum Color : bool {
-  white = true,
-  black = false,
-};
-
-// Overloading operator! to return Color instead of bool leads to segfault
-constexpr Color invert(const Color color) {
-  return static_cast<Color>(!color);
-}
+     "Type 'history' (or 'hist') to view a list of previous moves.\n"
+     "Type 'book' to list the opening book's moves for this position.\n"
+     "Type 'explore' to list the moves played here in the indexed games.\n"
+     "Type 'stats' to see call counts and timings of the hot paths.\n");
+
+constexpr char USAGE_TEXT[] =
+    ("Usage: chess [--fen <FEN>] [--perft <depth>] [--threads <n>] [--hash <MB>]\n"
+     "             [--perft-speedup]\n"
+     "       chess --import <PGN file> [--threads <n>]\n"
+     "       chess --import <PGN file> --build-book <book file>\n"
+     "       chess --engine <white|black> [--movetime <ms>] [--nodes <n>]\n"
+     "       chess [--index <file>]\n"
+     "       chess --uci [--threads <n>] [--hash <MB>] [--eval-file <f>] [--tb <dir>]\n"
+     "       chess --serve <socket> [--threads <n>]\n"
+     "       chess --bench-search <depth> [--fen <FEN>] [--threads <n>]\n"
+     "       chess --bench-nodes <depth> [--hash <MB>]\n"
+     "       chess --bench-eval <n> [--eval-file <file>]\n"
+     "       chess --export-net <file>\n"
+     "       chess --bench-san <n>\n"
+     "       chess … --stats-json <file>\n"
+     "  --fen <FEN>      start from the given position\n"
+     "  --perft <depth>  count all legal move sequences to the given depth\n"
+     "  --perft-speedup  count again on one thread to measure the speedup\n"
+     "  --threads <n>    number of threads, defaults to all cores\n"
+     "  --hash <MB>      transposition table size, 0 to disable\n"
+     "  --engine <color> let the computer play the given color\n"
+     "  --movetime <ms>  time the computer may think per move, default 1000\n"
+     "  --nodes <n>      number of positions it may search per move instead\n"
+     "  --book <file>    Polyglot opening book for the computer and 'book'\n"
+     "  --tb <directory> endgame tablebases made by chess-tbgen\n"
+     "  --index <file>   position index made by chess-index, for 'explore'\n"
+     "  --uci            talk the Universal Chess Interface for GUIs\n"
+     "  --serve <socket> host many games on a Unix domain socket\n"
+     "  --import <file>  replay and validate all games of a PGN file\n"
+     "  --build-book <f> write a book of the first 16 plies of the imported games\n"
+     "  --bench-search <depth> compare search speed on 1, 2, 4, … threads\n"
+     "  --bench-nodes <depth> count the nodes searched in a set of positions\n"
+     "  --eval-file <f>  evaluate positions with the given network\n"
+     "  --bench-eval <n> time the network on n positions, SIMD against scalar\n"
+     "  --export-net <f> write the piece-square evaluation as a network file\n"
+     "  --bench-san <n>  time SAN parsing of n moves from random games\n"
+     "  --stats-json <f> write the hot path statistics to the file at exit,\n"
+     "                   needs a build with -DCHESS_STATS=ON\n");
 
-enum Piece : uint8_t {
-  PAWN,
-  KNIGHT,
-  BISHOP,
-  ROOK,
-  QUEEN,
-  KING,
-};
-constexpr array<Piece, 6> PIECE_TYPES = {
-    PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING};
-
-struct ColorPiece {
-  Color color;
-  Piece piece;
-
-  constexpr bool operator==(const ColorPiece &other) const {
-    return color == other.color && piece == other.piece;
+/**
+ * Print the node count below each legal move, followed by the total and the
+ * time it took. Compare with other engines to debug the move generator. To
+ * measure the speedup of several threads, the tree is counted a second time
+ * on one thread.
+ */
+void run_perft(
+    const Game &game,
+    const uint8_t depth,
+    const size_t threads,
+    const size_t hash_megabytes,
+    const bool measure_speedup
+) {
+  const auto start = chrono::steady_clock::now();
+  Game root = game;
+  root.history.clear();
+  root.previous_hashes.clear();
+  unique_ptr<TranspositionTable> table = nullptr;
+  if (hash_megabytes) {
+    table = make_unique<TranspositionTable>(hash_megabytes);
   }
-};
-
-constexpr ColorPiece invert(ColorPiece piece) {
-  piece.color = invert(piece.color);
-  return piece;
-}
-
-string to_string(const ColorPiece &piece) {
-  static const array<array<string, 2>, 6> UTF8_PIECES = {
-      {
-          {"♙", "♟︎"},
-          {"♘", "♞"},
-          {"♗", "♝"},
-          {"♖", "♜"},
-          {"♕", "♛"},
-          {"♔", "♚"},
-      },
-  };
-  return UTF8_PIECES[piece.piece][piece.color];
-}
-
-constexpr ColorPiece WHITE_PAWN = {white, PAWN};
-constexpr ColorPiece WHITE_KNIGHT = {white, KNIGHT};
-constexpr ColorPiece WHITE_BISHOP = {white, BISHOP};
-constexpr ColorPiece WHITE_ROOK = {white, ROOK};
-constexpr ColorPiece WHITE_QUEEN = {white, QUEEN};
-constexpr ColorPiece WHITE_KING = {white, KING};
-constexpr ColorPiece BLACK_PAWN = {black, PAWN};
-constexpr ColorPiece BLACK_KNIGHT = {black, KNIGHT};
-constexpr ColorPiece BLACK_BISHOP = {black, BISHOP};
-constexpr ColorPiece BLACK_ROOK = {black, ROOK};
-constexpr ColorPiece BLACK_QUEEN = {black, QUEEN};
-constexpr ColorPiece BLACK_KING = {black, KING};
-
-typedef array<array<optional<ColorPiece>, 8>, 8> Board;
-
-// clang-format off
-constexpr Board STARTING_BOARD = {{
-  {WHITE_ROOK,   WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_ROOK},
-  {WHITE_KNIGHT, WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_KNIGHT},
-  {WHITE_BISHOP, WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_BISHOP},
-  {WHITE_QUEEN,  WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_QUEEN},
-  {WHITE_KING,   WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_KING},
-  {WHITE_BISHOP, WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_BISHOP},
-  {WHITE_KNIGHT, WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_KNIGHT},
-  {WHITE_ROOK,   WHITE_PAWN, {}, {}, {}, {}, BLACK_PAWN, BLACK_ROOK},
-}};
-// clang-format on
-
-struct Square {
-  uint8_t file;
-  uint8_t rank;
-
-  constexpr bool operator==(const Square &other) const {
-    return file == other.file && rank == other.rank;
-  }
-
-  constexpr bool exists() const {
-    return file <= 7 && rank <= 7;  // always >= 0 due to unsinged
+  uint64_t total = depth == 0;
+  optional<PerftScheduler> scheduler = nullopt;
+  if (depth > 0) {
+    const MoveList moves = generate_moves(root);
+    scheduler.emplace(threads, moves.size(), table.get());
+    const vector<uint64_t> nodes = scheduler->count(root, moves, depth);
+    for (size_t i = 0; i < moves.size(); ++i) {
+      cout << to_long_algebraic(moves[i]) << ": " << nodes[i] << endl;
+      total += nodes[i];
+    }
   }
-};
-
-string to_string(const Square &square) {
-  return {
-      static_cast<char>((square.file + 'a')),
-      static_cast<char>((square.rank + '1'))};
-}
-
-constexpr Square get_square(const char file, const char rank) {
-  return Square{uint8((file - 'a')), uint8((rank - '1'))};
+  const chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+  cout << "\nNodes searched: " << total << "\nTime: " << seconds.count()
+       << " s (" << static_cast<uint64_t>(total / seconds.count())
+       << " nodes/s)" << endl;
+  if (!scheduler) {
+    return;
+  }
+  optional<chrono::duration<double>> single_thread = nullopt;
+  if (measure_speedup && threads > 1) {
+    // count the tree again on one thread, from the same empty table
+    if (table) {
+      table->clear();
+    }
+    const MoveList moves = generate_moves(root);
+    PerftScheduler baseline(1, moves.size(), table.get());
+    baseline.count(root, moves, depth);
+    single_thread = baseline.time();
+  }
+  cout << endl;
+  scheduler->print_thread_stats(single_thread);
 }
 
-Square get_square(const string &square) {
-  return get_square(square[0], square[1]);
+/**
+ * SAN of random games from the starting position: a reproducible corpus that
+ * contains every kind of move, including checks, mates and promotions.
+ */
+vector<string> generate_san_corpus(const size_t size) {
+  mt19937 random(1);
+  vector<string> corpus;
+  corpus.reserve(size);
+  while (corpus.size() < size) {
+    Game game;
+    MoveList moves = generate_moves(game);
+    while (!moves.empty() && game.history.size() < 300 && corpus.size() < size) {
+      const Move &move = moves[random() % moves.size()];
+      corpus.push_back(encode_move(game, move));
+      apply_move(game, move);
+      moves = generate_moves(game);
+    }
+  }
+  return corpus;
 }
 
-struct Move {
-  string algebraic;
-  ColorPiece piece;
-  Square from;
-  Square to;
-  optional<ColorPiece> capture;
-  optional<ColorPiece> promotion;
-  bool check;
-};
-
-struct Game {
-  Board board = STARTING_BOARD;
-  vector<Move> history = {};
-  Color turn = white;
+/**
+ * Compare the throughput of parse_san with the regular expressions that were
+ * used to split SAN moves before. Only the parsing is timed, not the lookup
+ * of pieces on the board. The regular expressions never allowed check, mate
+ * or annotation symbols, so they get to see the moves without them.
+ */
+void run_san_benchmark(const size_t size) {
+  const regex PAWN_MOVE_PATTERN{"^([a-h][1-8])(:?=?([NBRQ]))?(?:\b|$)"};
+  const regex PAWN_CAPTURE_PATTERN{
+      "^([a-h])x([a-h][1-8])(:?=?([NBRQ]))?(?:\b|$)"};
+  const regex PIECE_MOVE_OR_CAPTURE_PATTERN{
+      "^([NBRQK])([a-h])?([1-8])?(x)?([a-h][1-8])(?:\b|$)"};
+  const regex CASTLING_PATTERN{"^[O0]-?[O0](-?[O0])?(?:\b|$)", regex::icase};
+
+  const vector<string> corpus = generate_san_corpus(size);
+  vector<string> plain_corpus;
+  for (const string &san : corpus) {
+    plain_corpus.push_back(san.substr(0, san.find_first_of("+#")));
+  }
 
-  struct CanCastle {
-    bool king_side;
-    bool queen_side;
+  const auto report = [&corpus](const string &name, const auto &parse) {
+    const auto start = chrono::steady_clock::now();
+    const size_t parsed = parse();
+    const chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+    cout << name << ": " << parsed << "/" << corpus.size() << " moves parsed, "
+         << fixed << setprecision(1) << 1e9 * seconds.count() / corpus.size()
+         << " ns/move, " << setprecision(0) << corpus.size() / seconds.count()
+         << " moves/s" << defaultfloat << endl;
+    return seconds.count();
   };
-  array<CanCastle, 2> can_castle = {{{true, true}, {true, true}}};
-};
 
-constexpr ColorPiece get_piece(const char piece_character, const Color color) {
-  switch (piece_character) {
-    case 'K':
-      return {color, KING};
-    case 'Q':
-      return {color, QUEEN};
-    case 'R':
-      return {color, ROOK};
-    case 'B':
-      return {color, BISHOP};
-    case 'N':
-      return {color, KNIGHT};
-    case 'P':
-      return {color, PAWN};
-    default:
-      throw string("Invalid piece '") + piece_character + "'";
-  }
+  const double regex_seconds = report("std::regex", [&] {
+    size_t parsed = 0;
+    smatch match;
+    for (const string &san : plain_corpus) {
+      // Like the old decode_move: try each pattern in turn and copy out the
+      // submatches it needs.
+      if (regex_match(san, match, PAWN_MOVE_PATTERN)) {
+        const string to = match[1], promotion = match[2];
+        parsed += !to.empty();
+      } else if (regex_match(san, match, PAWN_CAPTURE_PATTERN)) {
+        const string to = match[2], promotion = match[3];
+        parsed += !to.empty();
+      } else if (regex_match(san, match, PIECE_MOVE_OR_CAPTURE_PATTERN)) {
+        const string file = match[2], rank = match[3], to = match[5];
+        parsed += !to.empty();
+      } else if (regex_match(san, match, CASTLING_PATTERN)) {
+        parsed += 1;
+      }
+    }
+    return parsed;
+  });
+  const double parser_seconds = report("parse_san", [&] {
+    size_t parsed = 0;
+    for (const string &san : corpus) {
+      parsed += parse_san(san).has_value();
+    }
+    return parsed;
+  });
+  cout << "Speedup: " << fixed << setprecision(1)
+       << regex_seconds / parser_seconds << "x" << defaultfloat << endl;
 }
 
-constexpr optional<ColorPiece> get_piece(
-    const Board &board, const Square &square
-) {
-  return board[square.file][square.rank];
-}
+/**
+ * Validate every game of a PGN file on all threads. The file is mapped and
+ * handed out in batches of games; the reading thread waits while too many
+ * batches are in flight, and pages of completed batches are dropped again, so
+ * memory use does not grow with the file size.
+ */
+void run_import(const string &path, const size_t threads) {
+  constexpr size_t BATCH_GAMES = 256;
+
+  struct Batch {
+    size_t first_game;
+    size_t end_offset;
+    vector<string_view> games;
+    vector<string> errors = {};
+    size_t valid_games = 0;
+    size_t moves = 0;
+    atomic<bool> done = false;
+  };
 
-vector<Square> find_pieces(const Board &board, const ColorPiece &piece) {
-  vector<Square> squares;
-  for (uint8_t file = 0; file < 8; ++file) {
-    for (uint8_t rank = 0; rank < 8; ++rank) {
-      if (board[file][rank] == piece) {
-        squares.push_back({file, rank});
+  const auto start = chrono::steady_clock::now();
+  const MappedFile file(path);
+  file.advise_sequential();
+  PgnReader reader(file.view());
+
+  mutex lock;
+  condition_variable queue_changed;
+  deque<Batch *> queue;
+  bool finished = false;
+
+  vector<thread> workers;
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([&] {
+      while (true) {
+        Batch *batch;
+        {
+          unique_lock guard(lock);
+          queue_changed.wait(guard, [&] { return finished || !queue.empty(); });
+          if (queue.empty()) {
+            return;
+          }
+          batch = queue.front();
+          queue.pop_front();
+        }
+        queue_changed.notify_all();
+        for (size_t i = 0; i < batch->games.size(); ++i) {
+          try {
+            batch->moves += replay_pgn_game(batch->games[i]);
+            ++batch->valid_games;
+          } catch (string err) {
+            batch->errors.push_back(
+                "Game " + std::to_string(batch->first_game + i) + ", " + err
+            );
+          }
+        }
+        batch->done = true;
       }
-    }
+    });
   }
-  return squares;
-}
 
-template <size_t N>
-vector<Square> find_line_attacking_pieces(
-    const Board &board,
-    const Square &target_square,
-    const ColorPiece &piece,
-    const array<pair<int8_t, int8_t>, N> &directions,
-    const optional<uint8_t> file = nullopt,
-    const optional<uint8_t> rank = nullopt
-) {
-  vector<Square> found;
-  for (const auto &[d_file, d_rank] : directions) {
-    for (uint8_t offset = 1;; ++offset) {
-      Square square = {
-          uint8(target_square.file + offset * d_file),
-          uint8(target_square.rank + offset * d_rank)};
-      if (!square.exists()) {
-        break;
+  // Batches in file order, so errors are reported deterministically and
+  // memory is released front to back.
+  deque<unique_ptr<Batch>> in_flight;
+  size_t games = 0, valid_games = 0, moves = 0;
+  const auto collect = [&](const bool wait) {
+    while (!in_flight.empty() && (in_flight.front()->done || wait)) {
+      while (!in_flight.front()->done) {
+        this_thread::yield();
       }
-      const optional<ColorPiece> &found_piece = get_piece(board, square);
-      if (found_piece && found_piece == piece && (!file || square.file == file)
-          && (!rank || square.rank == rank)) {
-        found.push_back(square);
+      const Batch &batch = *in_flight.front();
+      for (const string &err : batch.errors) {
+        cout << err << '\n';
       }
-      if (found_piece) {
+      valid_games += batch.valid_games;
+      moves += batch.moves;
+      file.release(batch.end_offset);
+      in_flight.pop_front();
+    }
+  };
+
+  while (true) {
+    auto batch = make_unique<Batch>();
+    batch->first_game = games + 1;
+    while (batch->games.size() < BATCH_GAMES) {
+      const optional<string_view> game = reader.next_game();
+      if (!game) {
         break;
       }
+      batch->games.push_back(*game);
+    }
+    if (batch->games.empty()) {
+      break;
+    }
+    games += batch->games.size();
+    batch->end_offset = reader.offset();
+    {
+      unique_lock guard(lock);
+      queue_changed.wait(guard, [&] { return queue.size() < 2 * threads; });
+      queue.push_back(batch.get());
     }
+    queue_changed.notify_all();
+    in_flight.push_back(std::move(batch));
+    collect(in_flight.size() > 4 * threads);
   }
-  return found;
+  {
+    lock_guard guard(lock);
+    finished = true;
+  }
+  queue_changed.notify_all();
+  for (thread &worker : workers) {
+    worker.join();
+  }
+  collect(true);
+
+  const chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+  cout << "\nGames: " << games << " (" << valid_games << " valid, "
+       << games - valid_games << " with errors)\nMoves: " << moves
+       << "\nTime: " << seconds.count() << " s ("
+       << static_cast<uint64_t>(games / seconds.count()) << " games/s, "
+       << static_cast<uint64_t>(moves / seconds.count()) << " moves/s)"
+       << endl;
 }
 
-template <size_t N>
-vector<Square> find_direct_attacking_pieces(
-    const Board &board,
-    const Square &target_square,
-    const ColorPiece &piece,
-    const array<pair<int8_t, int8_t>, N> &moves,
-    const optional<uint8_t> file = nullopt,
-    const optional<uint8_t> rank = nullopt
+struct NetworkTiming {
+  vector<Accumulator> accumulators;
+  vector<int32_t> outputs;
+  chrono::duration<double> refresh;
+  chrono::duration<double> output;
+};
+
+template <bool simd>
+NetworkTiming time_network(
+    const Network &network, const vector<pair<Board, Color>> &positions
 ) {
-  vector<Square> found;
-  for (const auto &[d_file, d_rank] : moves) {
-    Square square = {
-        uint8(target_square.file + d_file), uint8(target_square.rank + d_rank)};
-    if (!square.exists()) {
-      continue;
-    }
-    if (file && square.file != *file || rank && square.rank != *rank) {
-      continue;
+  NetworkTiming timing;
+  timing.accumulators.resize(positions.size());
+  timing.outputs.resize(positions.size());
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < positions.size(); ++i) {
+    timing.accumulators[i] = refresh_accumulator<simd>(network, positions[i].first);
+  }
+  timing.refresh = chrono::steady_clock::now() - start;
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < positions.size(); ++i) {
+    timing.outputs[i] =
+        nnue_output<simd>(network, timing.accumulators[i], positions[i].second);
+  }
+  timing.output = chrono::steady_clock::now() - start;
+  return timing;
+}
+
+/**
+ * Time the network on positions from random games, once with the SIMD
+ * kernels of this build and once with the portable ones, and check that
+ * both agree bit for bit. While collecting the positions, every accumulator
+ * apply_move and undo_move update is compared to a full refresh.
+ */
+void run_eval_benchmark(const Network &network, const size_t size) {
+  mt19937 random(1);
+  vector<pair<Board, Color>> positions;
+  positions.reserve(size);
+  size_t mismatches = 0;
+  while (positions.size() < size) {
+    Game game;
+    attach_network(game, &network);
+    vector<pair<Move, Undo>> played;
+    while (positions.size() < size && played.size() < 200) {
+      const MoveList moves = generate_moves(game);
+      if (moves.empty()) {
+        break;
+      }
+      const Move move = moves[random() % moves.size()];
+      played.emplace_back(move, apply_move(game, move));
+      positions.emplace_back(game.board, game.turn);
+      mismatches += game.accumulator.values
+                 != refresh_accumulator(network, game.board).values;
     }
-    if (get_piece(board, square) == piece) {
-      found.push_back(square);
+    for (; !played.empty(); played.pop_back()) {
+      undo_move(game, played.back().first, played.back().second);
+      mismatches += game.accumulator.values
+                 != refresh_accumulator(network, game.board).values;
     }
   }
-  return found;
+
+  const NetworkTiming simd = time_network<true>(network, positions);
+  const NetworkTiming scalar = time_network<false>(network, positions);
+  const auto print = [size](const string &name, const NetworkTiming &timing) {
+    cout << name << setw(12) << static_cast<uint64_t>(size / timing.output.count())
+         << " evaluations/s" << setw(12)
+         << static_cast<uint64_t>(size / timing.refresh.count())
+         << " refreshes/s" << endl;
+  };
+  if (*NNUE_SIMD) {
+    print(string(NNUE_SIMD) + ":" + string(7 - strlen(NNUE_SIMD), ' '), simd);
+  } else {
+    cout << "No SIMD instructions enabled in this build." << endl;
+  }
+  print("Scalar: ", scalar);
+  const bool identical = simd.outputs == scalar.outputs
+                      && ranges::equal(
+                             simd.accumulators, scalar.accumulators,
+                             [](const Accumulator &a, const Accumulator &b) {
+                               return a.values == b.values;
+                             }
+                         );
+  cout << "Results identical: " << (identical ? "yes" : "NO")
+       << "\nIncremental updates differing from a refresh: " << mismatches
+       << endl;
 }
 
-vector<Square> find_attacking_pieces(
-    const Board &board,
-    const Square &target_square,
-    const ColorPiece &piece,
-    const optional<uint8_t> file = nullopt,
-    const optional<uint8_t> rank = nullopt
+/** Search with the given limits and print a line after every iteration */
+Move think(
+    const Game &game,
+    TranspositionTable &table,
+    const SearchLimits &limits,
+    const size_t threads,
+    const Tablebases *tablebases
 ) {
-  switch (piece.piece) {
-      // clang-format off
-    case PAWN:
-      return find_direct_attacking_pieces<2>(
-          board, target_square, piece,
-          {{{piece.color ? -1 : +1, -1}, {piece.color ? -1 : +1, +1}}},
-          file, rank
-      );
-    case KNIGHT:
-      return find_direct_attacking_pieces<8>(
-          board, target_square, piece,
-          {{{+1, +2}, {+1, -2}, {-1, +2}, {-1, -2},
-            {+2, +1}, {+2, -1}, {-2, +1}, {-2, -1}}},
-          file, rank
-      );
-    case BISHOP:
-      return find_line_attacking_pieces<4>(
-          board, target_square, piece,
-          {{{-1, -1}, {+1, -1}, {-1, +1}, {+1, +1}}},
-          file, rank
-      );
-    case ROOK:
-      return find_line_attacking_pieces<4>(
-          board, target_square, piece,
-          {{{0, -1}, {0, +1}, {-1, 0}, {+1, 0}}},
-          file, rank
-      );
-    case QUEEN:
-      return find_line_attacking_pieces<8>(
-          board, target_square, piece,
-          {{{-1, -1}, {+1, -1}, {-1, +1}, {+1, +1},
-            { 0, -1}, { 0, +1}, {-1,  0}, {+1,  0}}},
-          file, rank
-      );
-    case KING:
-      return find_direct_attacking_pieces<8>(
-          board, target_square, piece,
-          {{{-1, -1}, {+1, -1}, {-1, +1}, {+1, +1},
-            { 0, -1}, { 0, +1}, {-1,  0}, {+1,  0}}},
-          file, rank
-      );
-    // clang-format on
-    default:
-      throw string("Unknown piece code " + to_string(piece.piece));
-  }
+  const SearchReport result = parallel_search(
+      game, table, limits, threads, tablebases, [&game](const SearchReport &report) {
+        const double seconds = max(report.elapsed.count(), 1e-6);
+        cout << "depth " << setw(2) << int(report.depth) << "  score "
+             << setw(6) << format_score(report.score) << "  nodes " << setw(9)
+             << report.nodes << "  nps " << setw(8)
+             << static_cast<uint64_t>(report.nodes / seconds) << "  time "
+             << setw(5) << static_cast<uint64_t>(seconds * 1000) << " ms  pv"
+             << format_pv(game, report.pv) << endl;
+      });
+  return result.pv.front();
 }
 
-constexpr bool is_attacked(
-    const Board &board, const Square &square, const Color by_color
+/**
+ * Search the position to a fixed depth with 1, 2, 4, … threads up to the
+ * given number, each time with an empty table, and compare time to depth and
+ * nodes per second to the single-threaded run.
+ */
+void run_search_benchmark(
+    const Game &game,
+    const uint8_t depth,
+    const size_t threads,
+    const size_t hash_megabytes
 ) {
-  for (const Piece &piece : PIECE_TYPES) {
-    if (!find_attacking_pieces(board, square, {by_color, piece}).empty()) {
-      return true;
+  vector<size_t> counts;
+  for (size_t count = 1; count < threads; count *= 2) {
+    counts.push_back(count);
+  }
+  counts.push_back(threads);
+
+  TranspositionTable table(hash_megabytes);
+  optional<SearchReport> baseline = nullopt;
+  cout << "threads     time (s)        nodes        nps  speedup  nps scaling  "
+          "score  best\n";
+  for (const size_t count : counts) {
+    table.clear();
+    const SearchReport result = parallel_search(
+        game, table, {.depth = depth}, count, nullptr, [](const SearchReport &) {}
+    );
+    const double nps = result.nodes / max(result.elapsed.count(), 1e-6);
+    if (!baseline) {
+      baseline = result;
     }
+    const double baseline_nps =
+        baseline->nodes / max(baseline->elapsed.count(), 1e-6);
+    Game position = game;
+    cout << setw(7) << count << fixed << setprecision(3) << setw(13)
+         << result.elapsed.count() << setw(13) << result.nodes << setw(11)
+         << static_cast<uint64_t>(nps) << setprecision(2) << setw(8)
+         << baseline->elapsed / result.elapsed << "x" << setw(12)
+         << nps / baseline_nps << "x" << setw(7) << format_score(result.score)
+         << "  " << (result.pv.empty() ? "-" : encode_move(position, result.pv.front()))
+         << defaultfloat << endl;
   }
-  return false;
 }
 
-bool is_in_check(const Game &game, Color color) {
-  const vector<Square> &king_squares = find_pieces(game.board, {color, KING});
-  if (king_squares.size() != 1) {
-    throw string("You need exactly one King.");
+/** Openings, middlegames and endings with tactics, for run_node_benchmark */
+constexpr array<const char *, 8> BENCHMARK_POSITIONS = {
+    STARTING_FEN,
+    "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "8/5pk1/6p1/8/3R4/6P1/5PK1/3r4 w - - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+};
+
+/**
+ * Search each benchmark position to a fixed depth on one thread with an
+ * empty table. The node counts are deterministic, so they show exactly how
+ * much a change in move ordering or pruning saves.
+ */
+void run_node_benchmark(const uint8_t depth, const size_t hash_megabytes) {
+  TranspositionTable table(max<size_t>(1, hash_megabytes));
+  uint64_t total = 0;
+  chrono::duration<double> elapsed{0};
+  cout << "position        nodes   time (s)   score  best\n";
+  for (size_t i = 0; i < BENCHMARK_POSITIONS.size(); ++i) {
+    table.clear();
+    Game game = parse_fen(BENCHMARK_POSITIONS[i]);
+    const SearchReport result = parallel_search(
+        game, table, {.depth = depth}, 1, nullptr, [](const SearchReport &) {}
+    );
+    total += result.nodes;
+    elapsed += result.elapsed;
+    cout << setw(8) << i + 1 << setw(13) << result.nodes << fixed << setprecision(3)
+         << setw(11) << result.elapsed.count() << setw(8) << format_score(result.score)
+         << "  " << encode_move(game, result.pv.front()) << defaultfloat << endl;
   }
-  return is_attacked(game.board, king_squares[0], invert(color));
+  cout << "\nNodes: " << total << "\nTime: " << elapsed.count() << " s ("
+       << static_cast<uint64_t>(total / elapsed.count()) << " nodes/s)" << endl;
 }
 
+/**
+ * The Universal Chess Interface on standard input and output, for GUIs and
+ * match runners. Searches run on a background thread, so the input loop
+ * answers 'isready' and 'stop' right away while the engine thinks.
+ */
+class UciSession {
+  size_t threads;
+  size_t hash_megabytes;
+  unique_ptr<TranspositionTable> table;
+  const Network *network;
+  const Tablebases *tablebases;
 
-// TODO shortened pawn captures ("exd", "ed")
-const regex PAWN_MOVE_PATTERN{"^([a-h][1-8])(:?=?([NBRQ]))?(?:\b|$)"};
-const regex PAWN_CAPTURE_PATTERN{
-    "^([a-h])x([a-h][1-8])(:?=?([NBRQ]))?(?:\b|$)"};
-const regex PIECE_MOVE_OR_CAPTURE_PATTERN{
-    "^([NBRQK])([a-h])?([1-8])?(x)?([a-h][1-8])(?:\b|$)"};
-const regex CASTLING_PATTERN{"^[O0]-?[O0](-?[O0])?(?:\b|$)", regex::icase};
+  Game game;
+  /** The start and moves of the last 'position' command, which game is at */
+  string start;
+  vector<string> moves;
+
+  thread searcher;
+  atomic<bool> stop = false;
+  /** Lets an infinite search wait for 'stop' before it answers */
+  mutex stop_lock;
+  condition_variable stop_signal;
+  mutex output_lock;
+
+  void send(const string &line) {
+    lock_guard guard(output_lock);
+    cout << line << endl;
+  }
 
-constexpr optional<ColorPiece> get_promotion(
-    const Move &move, const Color color, const ssub_match &promo_match
-) {
-  optional<ColorPiece> promotion = nullopt;
-  if (promo_match.matched) {
-    promotion = get_piece(string(promo_match)[0], color);
-  }
-  const bool must_promote = color == white && move.to.rank == 7
-                            || color == black && move.to.rank == 0;
-  if (must_promote && !promotion) {
-    throw string("The pawn reaches the final rank and must be promoted.");
-  } else if (!must_promote && promotion) {
-    throw string("Can only promote on the final rank.");
-  }
-  return promotion;
-}
+  /** Stop the search if one is running and wait for its 'bestmove' */
+  void finish_search() {
+    if (!searcher.joinable()) {
+      return;
+    }
+    {
+      lock_guard guard(stop_lock);
+      stop = true;
+    }
+    stop_signal.notify_all();
+    searcher.join();
+  }
 
-/**
- * Extract all relevant details from a move given in algebraic notation on a
- * specific board and check if it is legal to apply.
- *
- * TODO check for mate
- */
-Move decode_move(const Game &game, const string &move) {
-  const auto &[board, history, turn, can_castle] = game;
-  Move mv;
-  mv.algebraic = move;
-  mv.check = false;
-  const int8_t forwards = turn ? 1 : -1;
-  smatch match;
-
-  if (regex_match(move, match, PAWN_MOVE_PATTERN)) {  // "e4"
-    mv.piece = get_piece('P', turn);
-    mv.to = get_square(match[1]);
-    mv.from.file = mv.to.file;
-
-    if (board[mv.from.file][mv.to.rank - forwards] == mv.piece) {
-      mv.from.rank = mv.to.rank - forwards;
-
-    } else if ((turn && mv.to.rank == 3 || !turn && mv.to.rank == 4) &&
-               !board[mv.from.file][mv.to.rank - forwards] &&
-               board[mv.from.file][mv.to.rank - 2 * forwards] == mv.piece) {
-      // Move two spaces from starting rank
-      mv.from.rank = mv.to.rank - 2 * forwards;
+  static string format_uci_score(const int16_t score) {
+    if (abs(score) > MATE_BOUND) {
+      const int moves = (MATE_SCORE - abs(score) + 1) / 2;
+      return "mate " + to_string(score > 0 ? moves : -moves);
+    }
+    return "cp " + to_string(score);
+  }
+
+  /**
+   * Set up the position, replaying only the new moves when the list extends
+   * the previous one, as it does for every move of a game.
+   */
+  void set_position(istringstream &command) {
+    string token, new_start;
+    command >> token;
+    if (token == "startpos") {
+      new_start = token;
+      command >> token;
+    } else if (token == "fen") {
+      while (command >> token && token != "moves") {
+        new_start += (new_start.empty() ? "" : " ") + token;
+      }
     } else {
-      throw string(
-          "There is no eligible Pawn on "
-          + to_string(Square{mv.from.file, uint8(mv.to.rank - forwards)})
-          + " or "
-          + to_string(Square{mv.from.file, uint8(mv.to.rank - 2 * forwards)})
-          + "."
-      );
+      send("info string position needs 'startpos' or 'fen'");
+      return;
+    }
+    vector<string> new_moves;
+    while (command >> token) {
+      new_moves.push_back(token);
     }
 
-    // Prevent illegal capture
-    if (get_piece(board, mv.to)) {
-      throw string(
-          to_string(mv.to) + " is blocked. Pawns can only capture diagonally."
-      );
+    const bool extends = new_start == start && new_moves.size() >= moves.size()
+                      && equal(moves.begin(), moves.end(), new_moves.begin());
+    try {
+      if (!extends) {
+        game = new_start == "startpos" ? Game() : parse_fen(new_start);
+        attach_network(game, network);
+        moves.clear();
+      }
+      start = new_start;
+      for (size_t i = moves.size(); i < new_moves.size(); ++i) {
+        const MoveList legal = generate_moves(game);
+        const auto move = ranges::find_if(legal, [&](const Move &move) {
+          return to_long_algebraic(move) == new_moves[i];
+        });
+        if (move == legal.end()) {
+          throw "illegal move " + new_moves[i];
+        }
+        apply_move(game, *move);
+        moves.push_back(new_moves[i]);
+      }
+    } catch (string err) {
+      send("info string " + err);
+      // start over with whatever comes next
+      start.clear();
+      moves.clear();
     }
+  }
 
-    mv.promotion = get_promotion(mv, turn, match[2]);
-
-  } else if (regex_match(move, match, PAWN_CAPTURE_PATTERN)) {  // "dxe4"
-    mv.piece = {turn, PAWN};
-    mv.to = get_square(match[2]);
-    mv.from = get_square(move[0], move[3] - forwards);
-    if (abs(mv.from.file - mv.to.file) != 1) {
-      throw string("Pawn must move one square diagonally when capturing.");
-    }
-    if (board[mv.from.file][mv.from.rank] != mv.piece) {
-      throw string("No eligible Pawn on " + to_string(mv.from) + ".");
-    }
-    mv.capture = get_piece(board, mv.to);
-    if (!mv.capture) {
-      // Check for en passant capture
-      const optional<ColorPiece> en_passant_capture =
-          get_piece(board, get_square(move[2], move[3] - forwards));
-      if (en_passant_capture == invert(mv.piece)) {
-        // check if opponent's pawn just moved by two ranks
-        const Move &previous = history.back();
-        if (previous.piece == invert(mv.piece)
-            && previous.from == get_square(move[2], move[3] + forwards)) {
-          mv.capture = en_passant_capture;
-        } else {
-          throw string("Can't capture en passant, the opposing pawn was moved "
-                       "too long ago.");
+  void go(istringstream &command) {
+    SearchLimits limits = {.stop = &stop};
+    optional<chrono::milliseconds> time_left = nullopt, increment = nullopt;
+    size_t moves_to_go = 30;
+    bool infinite = false;
+    const vector<string> tokens(
+        (istream_iterator<string>(command)), istream_iterator<string>()
+    );
+    const MoveList legal = generate_moves(game);
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      const string &token = tokens[i];
+      if (token == "infinite" || token == "ponder") {
+        // pondering searches with the clock's budget, but only answers
+        // at 'ponderhit' or 'stop'
+        infinite = true;
+        continue;
+      }
+      if (token == "searchmoves") {
+        for (; i + 1 < tokens.size(); ++i) {
+          const auto move = ranges::find_if(legal, [&](const Move &move) {
+            return to_long_algebraic(move) == tokens[i + 1];
+          });
+          if (move == legal.end()) {
+            break;
+          }
+          limits.root_moves.push_back(*move);
         }
-      } else {
-        throw string(
-            "There is nothing to capture on " + to_string(mv.to) + "."
-        );
+        continue;
+      }
+      // unknown tokens, and their arguments, are skipped
+      long long value = 0;
+      if (i + 1 == tokens.size() || !(istringstream(tokens[i + 1]) >> value)) {
+        continue;
+      }
+      ++i;
+      if (token == "depth") {
+        limits.depth = clamp<long long>(value, 1, MAX_PLY - 1);
+      } else if (token == "movetime") {
+        limits.movetime = chrono::milliseconds(max(1ll, value));
+      } else if (token == "nodes") {
+        limits.nodes = max(1ll, value);
+      } else if (token == (game.turn ? "wtime" : "btime")) {
+        time_left = chrono::milliseconds(value);
+      } else if (token == (game.turn ? "winc" : "binc")) {
+        increment = chrono::milliseconds(value);
+      } else if (token == "movestogo") {
+        moves_to_go = max(1ll, value);
       }
     }
-    if (turn == mv.capture->color) {
-      throw string("Can't capture your own piece.");
+    if (time_left && !limits.movetime) {
+      // an even share of the clock, keeping a margin for the overhead
+      const chrono::milliseconds share =
+          *time_left / moves_to_go + increment.value_or(chrono::milliseconds(0)) * 3 / 4;
+      limits.movetime = clamp(
+          share, chrono::milliseconds(1),
+          max(chrono::milliseconds(1), *time_left - chrono::milliseconds(50))
+      );
     }
 
-    mv.promotion = get_promotion(mv, turn, match[3]);
-
-  } else if (regex_match(move, match, PIECE_MOVE_OR_CAPTURE_PATTERN)) {
-    // "Qe4, Qxe4, Qde4, Qdxe4, Q3e4, Q3xe4, Qd3e4, Qd3xe4"
-    mv.piece = get_piece(move[0], turn);
-    mv.to = get_square(match[5]);
+    stop = false;
+    searcher = thread([this, limits, infinite, position = game] {
+      const SearchReport result = parallel_search(
+          position, *table, limits, threads, tablebases,
+          [this, &position](const SearchReport &report) {
+            const double seconds = max(report.elapsed.count(), 1e-6);
+            string pv;
+            for (const Move &move : report.pv) {
+              pv += ' ';
+              pv += to_long_algebraic(move);
+            }
+            send("info depth " + to_string(report.depth) + " score "
+                 + format_uci_score(report.score) + " nodes " + to_string(report.nodes)
+                 + " nps " + to_string(static_cast<uint64_t>(report.nodes / seconds))
+                 + " time " + to_string(static_cast<uint64_t>(seconds * 1000)) + " pv"
+                 + pv);
+          }
+      );
+      if (infinite) {
+        // the protocol wants the best move only after 'stop'
+        unique_lock guard(stop_lock);
+        stop_signal.wait(guard, [this] { return stop.load(); });
+      }
+      send(
+          "bestmove "
+          + (result.pv.empty() ? "0000" : to_long_algebraic(result.pv.front()))
+      );
+    });
+  }
 
-    // Decode optional starting square qualifiers
-    optional<uint8_t> from_file = nullopt;
-    optional<uint8_t> from_rank = nullopt;
-    if (match[2].matched) {
-      from_file = string(match[2])[0] - 'a';
+  void set_option(istringstream &command) {
+    string token, name, value;
+    command >> token;
+    while (command >> token && token != "value") {
+      name += (name.empty() ? "" : " ") + token;
     }
-    if (match[3].matched) {
-      from_rank = string(match[3])[0] - '1';
+    command >> value;
+    if (name == "Hash") {
+      hash_megabytes = clamp(atoi(value.c_str()), 1, 65536);
+      table = make_unique<TranspositionTable>(hash_megabytes);
+    } else if (name == "Threads") {
+      threads = clamp(atoi(value.c_str()), 1, 1024);
+    } else {
+      send("info string unknown option " + name);
     }
+  }
 
-    // Search for matching pieces
-    const vector<Square> candidates =
-        find_attacking_pieces(board, mv.to, mv.piece, from_file, from_rank);
-    switch (candidates.size()) {
-      case 1:
-        mv.from = candidates[0];
-        break;
-      case 0:
-        throw string("No candidate pieces available.");
-      default:
-        throw string("Ambiguous move: multiple pieces available.");
-    }
-
-    // Check for captures
-    mv.capture = get_piece(board, mv.to);
-    if (match[3].matched) {
-      if (!mv.capture) {
-        throw string(
-            "There is nothing to capture on " + to_string(mv.to) + "."
+ public:
+  UciSession(
+      const size_t threads,
+      const size_t hash_megabytes,
+      const Network *network,
+      const Tablebases *tablebases
+  )
+      : threads(threads),
+        hash_megabytes(max<size_t>(1, hash_megabytes)),
+        table(make_unique<TranspositionTable>(this->hash_megabytes)),
+        network(network),
+        tablebases(tablebases) {
+    attach_network(game, network);
+  }
+
+  ~UciSession() {
+    finish_search();
+  }
+
+  /** Read commands until 'quit' or the end of the input */
+  void run() {
+    string line;
+    while (getline(cin, line)) {
+      istringstream command(line);
+      string name;
+      command >> name;
+      if (name == "uci") {
+        send(
+            "id name Chess CLI\nid author Chess CLI developers\n"
+            "option name Hash type spin default "
+            + to_string(hash_megabytes)
+            + " min 1 max 65536\noption name Threads type spin default "
+            + to_string(threads) + " min 1 max 1024\nuciok"
         );
-      } else if (turn == mv.capture->color) {
-        throw string("Can't capture your own piece.");
-      }
-    } else {
-      if (mv.capture) {
-        throw string("Target square is occupied")
-            + (turn == mv.capture->color ? " by your own piece."
-                                         : ", add 'x' to capture.");
+      } else if (name == "isready") {
+        send("readyok");
+      } else if (name == "stop" || name == "ponderhit") {
+        finish_search();
+      } else if (name == "quit") {
+        break;
+      } else if (name == "ucinewgame") {
+        finish_search();
+        table->clear();
+      } else if (name == "position") {
+        finish_search();
+        set_position(command);
+      } else if (name == "go") {
+        finish_search();
+        go(command);
+      } else if (name == "setoption") {
+        finish_search();
+        set_option(command);
+      } else if (!name.empty()) {
+        send("info string unknown command " + name);
       }
     }
+  }
+};
 
-  } else if (regex_match(move, match, CASTLING_PATTERN)) {
-    const bool castle_long = match[1].matched;
-    if (castle_long ? !can_castle[turn].king_side
-                    : !can_castle[turn].queen_side) {
-      throw string("You can no longer castle on this side of the board, "
-                   "the King or Rook has already moved.");
-    }
-    const uint8_t rank = white ? 0 : 7;
-    if (castle_long ? board[1][rank] || board[2][rank] || board[3][rank]
-                    : board[6][rank] || board[5][rank]) {
-      throw string("You cannot castle on this side of the board, "
-                   "there is a piece in the way.");
-    }
-    if (is_attacked(board, {uint8(castle_long ? 3 : 5), rank}, invert(turn))) {
-      throw string("You cannot castle on this side of the board, "
-                   "the King may not pass through check.");
-    }
-    mv.piece = ColorPiece{turn, KING};
-    mv.from = Square{4, rank};
-    mv.to = Square{uint8(castle_long ? 2 : 6), rank};
-
+/** What the tablebases know about the position, if it is in one */
+void print_tablebase_result(const Game &game, const Tablebases &tablebases) {
+  const optional<TablebaseResult> result = tablebases.probe(game);
+  if (!result) {
+    return;
+  }
+  const string side = game.turn ? "White" : "Black";
+  const string opponent = game.turn ? "Black" : "White";
+  const int moves = (result->plies + 1) / 2;
+  if (result->wdl == Wdl::WIN) {
+    cout << "Tablebase: " << side << " mates in " << moves << ".\n" << endl;
+  } else if (result->wdl == Wdl::LOSS) {
+    cout << "Tablebase: " << opponent << " mates in " << moves << ".\n" << endl;
   } else {
-    throw string(
-        "'" + move
-        + "' is not a known move format.\n"
-          "Note: Do not add any special characters like + # = "
-          "to indicate check/mate/promotion."
-    );
+    cout << "Tablebase: the position is drawn.\n" << endl;
   }
-  return mv;
 }
 
-/**
- * Execute a decoded move on the given board. This function assumes that all
- * checks have passed and that it can be applied to the given board to create a
- * valid game state.
- */
-void apply_move(Game &game, const Move &move) {
-  auto &[board, history, turn, can_castle] = game;
-  const ColorPiece &piece = *board[move.from.file][move.from.rank];
-
-  // capture en passant
-  const optional<ColorPiece> &capture = board[move.to.file][move.to.rank];
-  if (!capture && move.capture == ColorPiece(invert(piece.color), PAWN)) {
-    board[move.to.file][move.from.rank] = nullopt;
-  }
-
-  // move
-  board[move.from.file][move.from.rank] = nullopt;
-  board[move.to.file][move.to.rank] = move.promotion.value_or(piece);
-
-  // castling
-  if ((piece == WHITE_KING || piece == BLACK_KING)
-      && abs(move.from.file - move.to.file) == 2) {
-    if (move.to.file == 2) {  // castling long
-      board[3][move.to.rank] = board[0][move.to.rank];
-      board[0][move.to.rank] = nullopt;
-      can_castle[turn].queen_side = false;
-    } else {  // castling short
-      board[5][move.to.rank] = board[7][move.to.rank];
-      board[7][move.to.rank] = nullopt;
-      can_castle[turn].king_side = false;
-    }
-  }
-  if (move.from.rank == (turn ? 0 : 7)) {
-    if (move.piece.piece == KING) {
-      can_castle[turn] = {false, false};
-    } else if (move.piece.piece == ROOK) {
-      if (move.from.file == 0) {
-        can_castle[turn].queen_side = false;
-      } else if (move.from.file == 7) {
-        can_castle[turn].queen_side = false;
-      }
+/** List the moves in algebraic notation, regenerated by replaying the game. */
+void print_history(const Game &game) {
+  Game replay =
+      game.starting_fen.empty() ? Game() : parse_fen(game.starting_fen);
+  size_t ply = 0;
+  if (!replay.turn && !game.history.empty()) {
+    cout << "1.\t...";
+    ply = 1;
+  }
+  for (const Move &move : game.history) {
+    if (ply % 2 == 0) {
+      cout << (ply / 2 + 1) << ".\t" << encode_move(replay, move);
+    } else {
+      cout << "\t" << encode_move(replay, move) << endl;
     }
+    apply_move(replay, move);
+    ++ply;
+  }
+  if (ply % 2) {
+    cout << endl;
   }
-
-  history.push_back(move);
-  turn = invert(turn);
 }
 
-// const string ANSI_RED = "\033[31m";
-const string ANSI_INVERT = "\033[0;0;7m";
-const string ANSI_RESET = "\033[0m";
-
-string invert(const string &str) {
-  return ANSI_INVERT + str + ANSI_RESET;
+/** Moves of the indexed games in this position, with results and games */
+void print_explored_moves(Game &game, const PositionIndex &index) {
+  const auto start = chrono::steady_clock::now();
+  const vector<ExploredMove> moves = index.lookup(game);
+  const chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+  if (moves.empty()) {
+    cout << "No indexed game reached this position." << endl;
+    return;
+  }
+  cout << "    move   games  white  draws  black  games at byte offsets" << endl;
+  for (const ExploredMove &move : moves) {
+    const auto percent = [&move](const uint32_t count) {
+      return 100.0 * count / move.games;
+    };
+    cout << setw(8) << encode_move(game, move.move) << setw(8) << move.games << fixed
+         << setprecision(1) << setw(6) << percent(move.white_wins) << "%" << setw(6)
+         << percent(move.draws) << "%" << setw(6) << percent(move.black_wins) << "% "
+         << defaultfloat;
+    for (const uint64_t offset : move.game_offsets) {
+      cout << " " << offset;
+    }
+    cout << (move.games > move.game_offsets.size() ? " …" : "") << endl;
+  }
+  cout << "(looked up in " << elapsed.count() << " ms)" << endl;
 }
 
-constexpr uint8_t FORWARD_8[8] = {0, 1, 2, 3, 4, 5, 6, 7};
-constexpr uint8_t REVERSE_8[8] = {7, 6, 5, 4, 3, 2, 1, 0};
+/** Writes the statistics to a file when it goes out of scope at exit */
+struct StatsDump {
+  optional<string> path;
 
-constexpr uint8_t BOARD_HEADER_HEIGHT = 2;
-constexpr uint8_t BOARD_CONTENT_HEIGHT = 8;
-constexpr uint8_t BOARD_FOOTER_HEIGHT = 1;
-constexpr uint8_t BOARD_HEIGHT =
-    BOARD_HEADER_HEIGHT + BOARD_CONTENT_HEIGHT + BOARD_FOOTER_HEIGHT;
-
-array<string, BOARD_HEIGHT> board_to_lines(
-    const Board &board, const Color color = white
-) {
-  array<string, BOARD_HEIGHT> lines;
-  lines[0] = color ? "       WHITE        " : "       BLACK        ";
-  lines[1] = color ? "  a b c d e f g h   " : "  h g f e d c b a   ";
-  lines[10] = color ? "  a b c d e f g h   " : "  h g f e d c b a   ";
-
-  Color square_color = black;
-  for (const uint8_t rank : color ? REVERSE_8 : FORWARD_8) {
-    const uint8_t line = (color ? 7 - rank : rank) + BOARD_HEADER_HEIGHT;
-    lines[line] = to_string(rank + 1) + " ";
-    for (const uint8_t file : color ? FORWARD_8 : REVERSE_8) {
-      optional<ColorPiece> piece = board[file][rank];
-      string piece_string = "  ";
-      if (piece) {
-        piece_string = to_string(square_color ? invert(*piece) : *piece) + " ";
+  ~StatsDump() {
+    if (path) {
+      ofstream file(*path);
+      file << stats_json();
+      if (!file) {
+        cerr << "Can't write " << *path << endl;
       }
-      lines[line] += square_color ? invert(piece_string) : piece_string;
-      square_color = invert(square_color);
     }
-    square_color = invert(square_color);
-    lines[line] += " " + to_string(rank + 1);
   }
+};
 
-  return lines;
-}
+int main(int argc, char *argv[]) {
+  const vector<string> args(argv + 1, argv + argc);
+  optional<int> perft_depth = nullopt;
+  bool perft_speedup = false;
+  optional<int> san_benchmark_size = nullopt;
+  optional<int> search_benchmark_depth = nullopt;
+  optional<int> node_benchmark_depth = nullopt;
+  optional<int> eval_benchmark_size = nullopt;
+  optional<string> network_path = nullopt;
+  optional<string> export_path = nullopt;
+  optional<string> book_path = nullopt;
+  optional<string> tablebase_path = nullopt;
+  optional<string> index_path = nullopt;
+  bool uci = false;
+  optional<string> socket_path = nullopt;
+  optional<string> build_book_path = nullopt;
+  optional<string> import_path = nullopt;
+  string fen = STARTING_FEN;
+  size_t threads = max(1u, thread::hardware_concurrency());
+  size_t hash_megabytes = 64;
+  optional<Color> engine_color = nullopt;
+  SearchLimits limits = {.movetime = chrono::milliseconds(1000)};
+  StatsDump stats_dump;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--perft" && i + 1 < args.size()) {
+      // the depth is a uint8_t below, where -1 would become 255
+      const string &value = args[++i];
+      int depth = -1;
+      const auto [end, error] =
+          from_chars(value.data(), value.data() + value.size(), depth);
+      if (error != errc() || end != value.data() + value.size() || depth < 0
+          || depth >= MAX_PLY) {
+        cerr << "The perft depth must be a number from 0 to " << MAX_PLY - 1
+             << "." << endl;
+        return 1;
+      }
+      perft_depth = depth;
+    } else if (args[i] == "--perft-speedup") {
+      perft_speedup = true;
+    } else if (args[i] == "--bench-san" && i + 1 < args.size()) {
+      san_benchmark_size = max(1, atoi(args[++i].c_str()));
+    } else if (args[i] == "--bench-nodes" && i + 1 < args.size()) {
+      node_benchmark_depth = clamp(atoi(args[++i].c_str()), 1, MAX_PLY - 1);
+    } else if (args[i] == "--bench-search" && i + 1 < args.size()) {
+      search_benchmark_depth = clamp(atoi(args[++i].c_str()), 1, MAX_PLY - 1);
+    } else if (args[i] == "--bench-eval" && i + 1 < args.size()) {
+      eval_benchmark_size = max(1, atoi(args[++i].c_str()));
+    } else if (args[i] == "--eval-file" && i + 1 < args.size()) {
+      network_path = args[++i];
+    } else if (args[i] == "--export-net" && i + 1 < args.size()) {
+      export_path = args[++i];
+    } else if (args[i] == "--book" && i + 1 < args.size()) {
+      book_path = args[++i];
+    } else if (args[i] == "--tb" && i + 1 < args.size()) {
+      tablebase_path = args[++i];
+    } else if (args[i] == "--index" && i + 1 < args.size()) {
+      index_path = args[++i];
+    } else if (args[i] == "--build-book" && i + 1 < args.size()) {
+      build_book_path = args[++i];
+    } else if (args[i] == "--import" && i + 1 < args.size()) {
+      import_path = args[++i];
+    } else if (args[i] == "--hash" && i + 1 < args.size()) {
+      hash_megabytes = max(0, atoi(args[++i].c_str()));
+    } else if (args[i] == "--threads" && i + 1 < args.size()) {
+      threads = max(1, atoi(args[++i].c_str()));
+    } else if (args[i] == "--engine" && i + 1 < args.size()
+               && (args[i + 1] == "white" || args[i + 1] == "black")) {
+      engine_color = args[++i] == "white" ? white : black;
+    } else if (args[i] == "--movetime" && i + 1 < args.size()) {
+      limits.movetime = chrono::milliseconds(max(1, atoi(args[++i].c_str())));
+    } else if (args[i] == "--nodes" && i + 1 < args.size()) {
+      limits.nodes = max(1ll, atoll(args[++i].c_str()));
+      limits.movetime = nullopt;
+    } else if (args[i] == "--fen" && i + 1 < args.size()) {
+      fen = args[++i];
+    } else if (args[i] == "--uci") {
+      uci = true;
+    } else if (args[i] == "--serve" && i + 1 < args.size()) {
+      socket_path = args[++i];
+    } else if (args[i] == "--stats-json" && i + 1 < args.size()) {
+      if (!STATS_ENABLED) {
+        cerr << "Statistics are not compiled in, configure with -DCHESS_STATS=ON."
+             << endl;
+        return 1;
+      }
+      stats_dump.path = args[++i];
+    } else {
+      cerr << USAGE_TEXT;
+      return args[i] == "--help" ? 0 : 1;
+    }
+  }
 
-template <size_t size>
-array<string, size> concat_lines(
-    const array<string, size> &a, const array<string, size> &b
-) {
-  array<string, size> result = {};
-  for (u_long i = 0; i < size; ++i) {
-    result[i] = a[i] + b[i];
+  Game game;
+  try {
+    game = parse_fen(fen);
+  } catch (string err) {
+    cerr << "Invalid FEN: " << err << endl;
+    return 1;
   }
-  return result;
-}
 
-template <size_t size> string join_lines(const array<string, size> &lines) {
-  string result = "";
-  for (const string &line : lines) {
-    result += line + "\n";
+  unique_ptr<Network> network = nullptr;
+  try {
+    if (export_path) {
+      save_network(*make_piece_square_network(), *export_path);
+      return 0;
+    }
+    if (network_path) {
+      network = load_network(*network_path);
+    }
+  } catch (string err) {
+    cerr << err << endl;
+    return 1;
   }
-  return result;
-}
+  attach_network(game, network.get());
 
-void print_board(const Board &board) {
-  array<string, BOARD_HEIGHT> gap;
-  fill(gap.begin(), gap.end(), "   ");
-  cout << join_lines(concat_lines(
-      concat_lines<BOARD_HEIGHT>(board_to_lines(board), gap),
-      board_to_lines(board, black)
-  ));
-}
+  if (eval_benchmark_size) {
+    run_eval_benchmark(
+        network ? *network : *make_piece_square_network(), *eval_benchmark_size
+    );
+    return 0;
+  }
+  if (import_path) {
+    try {
+      if (build_book_path) {
+        build_book(*import_path, *build_book_path, 16);
+      } else {
+        run_import(*import_path, threads);
+      }
+    } catch (string err) {
+      cerr << err << endl;
+      return 1;
+    }
+    return 0;
+  }
+  if (san_benchmark_size) {
+    run_san_benchmark(*san_benchmark_size);
+    return 0;
+  }
+  if (node_benchmark_depth) {
+    run_node_benchmark(*node_benchmark_depth, hash_megabytes);
+    return 0;
+  }
+  if (search_benchmark_depth) {
+    run_search_benchmark(game, *search_benchmark_depth, threads, hash_megabytes);
+    return 0;
+  }
+  if (perft_depth) {
+    run_perft(game, *perft_depth, threads, hash_megabytes, perft_speedup);
+    return 0;
+  }
+  if (socket_path) {
+    try {
+      serve(*socket_path, threads);
+    } catch (string err) {
+      cerr << err << endl;
+      return 1;
+    }
+    return 0;
+  }
 
-void print_history(const vector<Move> &history) {
-  const ushort len = history.size();
-  for (ushort mv = 0; mv + 1 < len; mv += 2) {
-    cout << (mv / 2 + 1) << ".\t" << history[mv].algebraic << "\t"
-         << history[mv + 1].algebraic << endl;
+  unique_ptr<TranspositionTable> table = nullptr;
+  if (engine_color) {
+    table = make_unique<TranspositionTable>(hash_megabytes);
   }
-  if (len % 2) {
-    cout << (len / 2 + 1) << ".\t" << history.back().algebraic << endl;
+  unique_ptr<Book> book = nullptr;
+  if (book_path) {
+    try {
+      book = make_unique<Book>(*book_path);
+    } catch (string err) {
+      cerr << err << endl;
+      return 1;
+    }
   }
-}
+  unique_ptr<Tablebases> tablebases = nullptr;
+  if (tablebase_path) {
+    try {
+      tablebases = make_unique<Tablebases>(*tablebase_path);
+    } catch (string err) {
+      cerr << err << endl;
+      return 1;
+    }
+    if (tablebases->count() == 0) {
+      cerr << "No tablebases in '" << *tablebase_path << "'" << endl;
+      return 1;
+    }
+  }
+  unique_ptr<PositionIndex> index = nullptr;
+  if (index_path) {
+    try {
+      index = make_unique<PositionIndex>(*index_path);
+    } catch (string err) {
+      cerr << err << endl;
+      return 1;
+    }
+  }
+  if (uci) {
+    UciSession(threads, hash_megabytes, network.get(), tablebases.get()).run();
+    return 0;
+  }
+  mt19937 random(random_device{}());
 
-int main() {
   cout << HELP_TEXT << endl;
 
-  Game game;
-
+  BoardRenderer renderer;
   bool exit = false;
   while (!exit) {
     if (game.turn) {
       cout << "                "
            << "{ Move " << (game.history.size() + 1) << " }" << endl;
     }
-    cout << endl;
-    print_board(game.board);
-    cout << endl;
+    renderer.draw(game);
+    if (is_checkmate(game)) {
+      cout << "Checkmate, " << (game.turn ? "Black" : "White")
+           << " wins! Type 'restart' for a new game.\n" << endl;
+    } else if (is_stalemate(game)) {
+      cout << "Stalemate, the game is drawn. Type 'restart' for a new game.\n"
+           << endl;
+    } else if (game.threats.checkers) {
+      cout << "Check!\n" << endl;
+    }
+    if (tablebases && has_legal_moves(game)) {
+      print_tablebase_result(game, *tablebases);
+    }
+
+    if (engine_color == game.turn && has_legal_moves(game)) {
+      optional<Move> move = nullopt;
+      if (book) {
+        move = Book::choose(book->lookup(game), random);
+      }
+      const bool from_book = move.has_value();
+      if (!move) {
+        move = think(game, *table, limits, threads, tablebases.get());
+      }
+      cout << "\n" << (game.turn ? "White" : "Black") << " plays "
+           << encode_move(game, *move) << (from_book ? " (book)" : "") << "\n"
+           << endl;
+      apply_move(game, *move);
+      if (is_threefold_repetition(game)) {
+        cout << "The same position occurred three times, "
+                "the game may be claimed a draw."
+             << endl;
+      }
+      continue;
+    }
 
     while (true) {
       cout << (game.turn ? "White> " : "Black> ");
@@ -669,7 +1143,43 @@ int main() {
         cout << HELP_TEXT << endl;
 
       } else if (input.starts_with("sum") || input.starts_with("hist")) {
-        print_history(game.history);
+        print_history(game);
+
+      } else if (input == "book") {
+        if (!book) {
+          cout << "No opening book, start with --book <file>." << endl;
+          continue;
+        }
+        const vector<pair<Move, uint16_t>> moves = book->lookup(game);
+        uint32_t total = 0;
+        for (const auto &[move, weight] : moves) {
+          total += weight;
+        }
+        for (const auto &[move, weight] : moves) {
+          cout << setw(8) << encode_move(game, move) << setw(7) << weight
+               << setw(6) << fixed << setprecision(1)
+               << 100.0 * weight / max<uint32_t>(total, 1) << "%"
+               << defaultfloat << endl;
+        }
+        if (moves.empty()) {
+          cout << "No book moves for this position." << endl;
+        }
+
+      } else if (input == "explore") {
+        if (!index) {
+          cout << "No position index, start with --index <file>." << endl;
+          continue;
+        }
+        print_explored_moves(game, *index);
+
+      } else if (input == "stats") {
+        if (STATS_ENABLED) {
+          cout << stats_report();
+        } else {
+          cout << "Statistics are not compiled in, configure with "
+                  "-DCHESS_STATS=ON."
+               << endl;
+        }
 
       } else if (input == "exit" || input == "quit" || input == "") {
         exit = true;
@@ -677,17 +1187,22 @@ int main() {
 
       } else if (input.starts_with("res")) {
         game = Game();
+        attach_network(game, network.get());
         break;
 
       } else {
         try {
-          Move move = decode_move(game, input);
-          Game updated = game;
-          apply_move(updated, move);
-          if (is_in_check(updated, game.turn)) {
+          const Move move = decode_move(game, input);
+          const Undo undo = apply_move(game, move);
+          if (is_in_check(game, invert(game.turn))) {
+            undo_move(game, move, undo);
             throw string("You are in check.");
           } else {
-            game = updated;
+            if (is_threefold_repetition(game)) {
+              cout << "The same position occurred three times, "
+                      "the game may be claimed a draw."
+                   << endl;
+            }
             break;
           }
         } catch (string err) {
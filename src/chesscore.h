@@ -0,0 +1,25 @@
+#pragma once
+
+/**
+ * The chesscore library: the rules of chess with FEN and Standard Algebraic
+ * Notation, PGN replay, opening books, position indexes, endgame
+ * tablebases, evaluation, search and drawing the board. The chess command
+ * line and tools are front-ends to it, and other programs can link it to
+ * work with positions in-process.
+ *
+ * Rules, FEN and SAN live in board.h and the evaluation network in nnue.h;
+ * the other headers each add one part.
+ */
+
+#include "board.h"
+#include "book.h"
+#include "evaluation.h"
+#include "nnue.h"
+#include "perft.h"
+#include "pgn.h"
+#include "position_index.h"
+#include "renderer.h"
+#include "search.h"
+#include "stats.h"
+#include "tablebase.h"
+#include "transposition_table.h"
@@ -0,0 +1,168 @@
+#include "evaluation.h"
+
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+
+using namespace std;
+
+int16_t evaluate(const Game &game) {
+  if (game.network) {
+    const int32_t score =
+        nnue_output(*game.network, game.accumulator, game.turn) / NNUE_OUTPUT_SCALE;
+    return clamp<int32_t>(score, -MATE_BOUND + 1, MATE_BOUND - 1);
+  }
+  int16_t score = 0;
+  for (const Color color : {white, black}) {
+    // Black sees the drawing as it is, White's squares are mirrored onto it
+    const uint8_t flip = color ? 56 : 0;
+    int16_t side = 0;
+    for (const Piece piece : PIECE_TYPES) {
+      Bitboard pieces = game.board.of({color, piece});
+      while (pieces) {
+        side += PIECE_VALUES[piece]
+              + PIECE_SQUARE_TABLES[piece][pop_square(pieces) ^ flip];
+      }
+    }
+    score += color == game.turn ? side : -side;
+  }
+  return score;
+}
+
+int16_t static_exchange(const Game &game, const Move &move) {
+  // the King can only take last, so any value above the others will do
+  constexpr array<int16_t, 6> VALUES = {
+      PIECE_VALUES[PAWN], PIECE_VALUES[KNIGHT], PIECE_VALUES[BISHOP],
+      PIECE_VALUES[ROOK], PIECE_VALUES[QUEEN],  2 * PIECE_VALUES[QUEEN]};
+  if (move.flag() == Move::CASTLING) {
+    return 0;
+  }
+  const Board &board = game.board;
+  const uint8_t from = move.from().index();
+  const uint8_t to = move.to().index();
+  const Bitboard diagonal = board.pieces[BISHOP] | board.pieces[QUEEN];
+  const Bitboard straight = board.pieces[ROOK] | board.pieces[QUEEN];
+
+  Bitboard occupied = board.occupied ^ square_mask(from);
+  // gains[i] is what the side making capture i wins if the exchange ends there
+  array<int16_t, 32> gains;
+  if (move.flag() == Move::EN_PASSANT) {
+    occupied ^= square_mask((from & 56) | (to & 7));
+    gains[0] = VALUES[PAWN];
+  } else {
+    const optional<ColorPiece> &victim = board.mailbox[to];
+    gains[0] = victim ? VALUES[victim->piece] : 0;
+  }
+  Piece on_target = board.mailbox[from]->piece;
+  if (const optional<Piece> promotion = move.promotion()) {
+    gains[0] += VALUES[*promotion] - VALUES[PAWN];
+    on_target = *promotion;
+  }
+
+  Bitboard attacking = (attackers(board, to, white, occupied)
+                        | attackers(board, to, black, occupied))
+                     & occupied;
+  Color side = invert(board.mailbox[from]->color);
+  size_t depth = 0;
+  while (Bitboard ours = attacking & board.colors[side]) {
+    Piece piece = PAWN;
+    while (!(ours & board.pieces[piece])) {
+      piece = static_cast<Piece>(piece + 1);
+    }
+    // taking with the King is only legal if nothing can take back
+    if (piece == KING && attacking & board.colors[invert(side)]) {
+      break;
+    }
+    ++depth;
+    gains[depth] = VALUES[on_target] - gains[depth - 1];
+    if (depth == gains.size() - 1) {
+      break;
+    }
+    occupied ^= ours & board.pieces[piece] & -(ours & board.pieces[piece]);
+    if (piece == PAWN || piece == BISHOP || piece == QUEEN) {
+      attacking |= bishop_attacks(to, occupied) & diagonal;
+    }
+    if (piece == ROOK || piece == QUEEN) {
+      attacking |= rook_attacks(to, occupied) & straight;
+    }
+    attacking &= occupied;
+    on_target = piece;
+    side = invert(side);
+  }
+  while (depth > 0) {
+    gains[depth - 1] = -max<int16_t>(-gains[depth - 1], gains[depth]);
+    --depth;
+  }
+  return gains[0];
+}
+
+unique_ptr<Network> make_piece_square_network() {
+  // nine Queens take 32 slices, the rest of the neurons go to the others
+  constexpr array<uint8_t, 6> SLICES = {5, 8, 8, 10, 32, 1};
+  static_assert(2 * accumulate(SLICES.begin(), SLICES.end(), 0) <= NNUE_HIDDEN);
+  // King bonuses can be negative, but there is only one King
+  constexpr int16_t KING_OFFSET = 64;
+  auto network = make_unique<Network>();
+  size_t neuron = 0;
+  for (const bool own : {true, false}) {
+    for (const Piece piece : PIECE_TYPES) {
+      for (uint8_t slice = 0; slice < SLICES[piece]; ++slice, ++neuron) {
+        network->feature_bias[neuron] =
+            -NNUE_CLIP * slice + (piece == KING ? KING_OFFSET : 0);
+        network->output_weights[0][neuron] =
+            own ? NNUE_OUTPUT_SCALE : -NNUE_OUTPUT_SCALE;
+        for (uint8_t square = 0; square < 64; ++square) {
+          // features are seen from White's side, the tables from Black's
+          const ColorPiece feature = {own ? white : black, piece};
+          network->feature_weights[nnue_feature(white, feature, square)][neuron] =
+              PIECE_VALUES[piece]
+              + PIECE_SQUARE_TABLES[piece][own ? square ^ 56 : square];
+        }
+      }
+    }
+  }
+  return network;
+}
+
+constexpr char NETWORK_MAGIC[4] = {'C', 'H', 'N', 'N'};
+
+void save_network(const Network &network, const string &path) {
+  ofstream file(path, ios::binary);
+  const uint32_t hidden = NNUE_HIDDEN;
+  file.write(NETWORK_MAGIC, sizeof(NETWORK_MAGIC));
+  file.write(reinterpret_cast<const char *>(&hidden), sizeof(hidden));
+  file.write(reinterpret_cast<const char *>(&network.feature_weights), sizeof(network.feature_weights));
+  file.write(reinterpret_cast<const char *>(&network.feature_bias), sizeof(network.feature_bias));
+  file.write(reinterpret_cast<const char *>(&network.output_weights), sizeof(network.output_weights));
+  file.write(reinterpret_cast<const char *>(&network.output_bias), sizeof(network.output_bias));
+  if (!file) {
+    throw string("Can't write ") + path;
+  }
+}
+
+unique_ptr<Network> load_network(const string &path) {
+  ifstream file(path, ios::binary);
+  if (!file) {
+    throw string("Can't open ") + path;
+  }
+  char magic[sizeof(NETWORK_MAGIC)];
+  uint32_t hidden = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char *>(&hidden), sizeof(hidden));
+  if (!file || !equal(begin(magic), end(magic), begin(NETWORK_MAGIC))) {
+    throw path + " is not a network file.";
+  }
+  if (hidden != NNUE_HIDDEN) {
+    throw path + " has " + std::to_string(hidden) + " hidden neurons, expected "
+        + std::to_string(NNUE_HIDDEN) + ".";
+  }
+  auto network = make_unique<Network>();
+  file.read(reinterpret_cast<char *>(&network->feature_weights), sizeof(network->feature_weights));
+  file.read(reinterpret_cast<char *>(&network->feature_bias), sizeof(network->feature_bias));
+  file.read(reinterpret_cast<char *>(&network->output_weights), sizeof(network->output_weights));
+  file.read(reinterpret_cast<char *>(&network->output_bias), sizeof(network->output_bias));
+  if (!file || file.peek() != ifstream::traits_type::eof()) {
+    throw path + " has the wrong size.";
+  }
+  return network;
+}
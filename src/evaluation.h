@@ -0,0 +1,112 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "board.h"
+#include "nnue.h"
+
+constexpr std::array<int16_t, 6> PIECE_VALUES = {100, 320, 330, 500, 900, 0};
+
+// Piece-square bonuses from White's point of view, drawn with rank 8 on top.
+// clang-format off
+constexpr std::array<std::array<int8_t, 64>, 6> PIECE_SQUARE_TABLES = {{
+  { 0,  0,  0,  0,  0,  0,  0,  0,
+   50, 50, 50, 50, 50, 50, 50, 50,
+   10, 10, 20, 30, 30, 20, 10, 10,
+    5,  5, 10, 25, 25, 10,  5,  5,
+    0,  0,  0, 20, 20,  0,  0,  0,
+    5, -5,-10,  0,  0,-10, -5,  5,
+    5, 10, 10,-20,-20, 10, 10,  5,
+    0,  0,  0,  0,  0,  0,  0,  0},
+  {-50,-40,-30,-30,-30,-30,-40,-50,
+   -40,-20,  0,  0,  0,  0,-20,-40,
+   -30,  0, 10, 15, 15, 10,  0,-30,
+   -30,  5, 15, 20, 20, 15,  5,-30,
+   -30,  0, 15, 20, 20, 15,  0,-30,
+   -30,  5, 10, 15, 15, 10,  5,-30,
+   -40,-20,  0,  5,  5,  0,-20,-40,
+   -50,-40,-30,-30,-30,-30,-40,-50},
+  {-20,-10,-10,-10,-10,-10,-10,-20,
+   -10,  0,  0,  0,  0,  0,  0,-10,
+   -10,  0,  5, 10, 10,  5,  0,-10,
+   -10,  5,  5, 10, 10,  5,  5,-10,
+   -10,  0, 10, 10, 10, 10,  0,-10,
+   -10, 10, 10, 10, 10, 10, 10,-10,
+   -10,  5,  0,  0,  0,  0,  5,-10,
+   -20,-10,-10,-10,-10,-10,-10,-20},
+  {  0,  0,  0,  0,  0,  0,  0,  0,
+     5, 10, 10, 10, 10, 10, 10,  5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+    -5,  0,  0,  0,  0,  0,  0, -5,
+     0,  0,  0,  5,  5,  0,  0,  0},
+  {-20,-10,-10, -5, -5,-10,-10,-20,
+   -10,  0,  0,  0,  0,  0,  0,-10,
+   -10,  0,  5,  5,  5,  5,  0,-10,
+    -5,  0,  5,  5,  5,  5,  0, -5,
+     0,  0,  5,  5,  5,  5,  0, -5,
+   -10,  5,  5,  5,  5,  5,  0,-10,
+   -10,  0,  5,  0,  0,  0,  0,-10,
+   -20,-10,-10, -5, -5,-10,-10,-20},
+  {-30,-40,-40,-50,-50,-40,-40,-30,
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -30,-40,-40,-50,-50,-40,-40,-30,
+   -20,-30,-30,-40,-40,-30,-30,-20,
+   -10,-20,-20,-20,-20,-20,-20,-10,
+    20, 20,  0,  0,  0,  0, 20, 20,
+    20, 30, 10,  0,  0, 10, 30, 20},
+}};
+// clang-format on
+
+constexpr uint8_t MAX_PLY = 64;
+constexpr int16_t INFINITE_SCORE = 32000;
+constexpr int16_t MATE_SCORE = 31000;
+/**
+ * Scores beyond this are mates, measured in plies from the root. Tablebases
+ * see mates far beyond the search's horizon, hence the wide margin.
+ */
+constexpr int16_t MATE_BOUND = MATE_SCORE - 1000;
+
+/**
+ * Static score of the position in centipawns from the point of view of the
+ * side to move. The network decides if the game has one, otherwise it is the
+ * material plus a bonus for where each piece stands.
+ */
+int16_t evaluate(const Game &game);
+
+/**
+ * Static exchange evaluation: the material the side to move gains by the
+ * move and the captures on its target square that follow, with both sides
+ * always taking with their least valuable attacker and free to stop when
+ * taking back would lose more. Sliders lined up behind a capturing piece
+ * join in as it leaves (x-rays). Promotions count, except by recaptures.
+ */
+int16_t static_exchange(const Game &game, const Move &move);
+
+/**
+ * A network that computes exactly the piece-square evaluation, as long as no
+ * side has more than six Knights, six Bishops, five Rooks or nine Queens,
+ * which covers any number of promotions to Queens. Each group of neurons sums one piece type
+ * of one side; as a neuron is clipped at NNUE_CLIP, a group uses a few of
+ * them with staggered biases, each passing on the next slice of the sum.
+ * Only the side to move's perspective is weighted.
+ *
+ * It is a reference for the file format and for testing, a trained network
+ * can simply replace it.
+ */
+std::unique_ptr<Network> make_piece_square_network();
+
+/**
+ * Network files start with NETWORK_MAGIC and the number of hidden neurons as
+ * a 32 bit integer, followed by the feature weights, feature biases, output
+ * weights and output bias as little-endian integers, in the order and sizes
+ * of Network.
+ */
+void save_network(const Network &network, const std::string &path);
+std::unique_ptr<Network> load_network(const std::string &path);
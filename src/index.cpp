@@ -0,0 +1,58 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "position_index.h"
+
+using namespace std;
+
+/**
+ * Build the position index of a PGN corpus for the 'explore' command of
+ * chess. This is a separate, offline step: indexing millions of games takes
+ * a while, but opening the result takes no time at all.
+ */
+
+constexpr char USAGE_TEXT[] =
+    ("Usage: chess-index <PGN file> <index file> [--memory <MB>]\n"
+     "  --memory <MB>  positions sorted in memory at once, default 1024;\n"
+     "                 larger corpora are sorted in runs and merged\n");
+
+int main(int argc, char *argv[]) {
+  const vector<string> args(argv + 1, argv + argc);
+  vector<string> paths;
+  size_t memory_megabytes = 1024;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--memory" && i + 1 < args.size()) {
+      memory_megabytes = max(1, atoi(args[++i].c_str()));
+    } else if (paths.size() < 2 && !args[i].starts_with("-")) {
+      paths.push_back(args[i]);
+    } else {
+      cerr << USAGE_TEXT;
+      return args[i] == "--help" ? 0 : 1;
+    }
+  }
+  if (paths.size() != 2) {
+    cerr << USAGE_TEXT;
+    return 1;
+  }
+
+  const auto start = chrono::steady_clock::now();
+  IndexSummary summary;
+  try {
+    summary = build_position_index(paths[0], paths[1], memory_megabytes);
+  } catch (string err) {
+    cerr << err << endl;
+    return 1;
+  }
+  const chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+  cout << "Games: " << summary.games << " (" << summary.invalid_games
+       << " with errors, indexed up to the error)\nPositions: " << summary.positions
+       << "\nEntries: " << summary.entries << " in " << summary.blocks
+       << " blocks\nSize: " << summary.bytes << " bytes ("
+       << (summary.entries ? double(summary.bytes) / summary.entries : 0)
+       << " per entry)\nTime: " << seconds.count() << " s ("
+       << static_cast<uint64_t>(summary.positions / seconds.count())
+       << " positions/s)" << endl;
+  return 0;
+}
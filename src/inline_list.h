@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+/**
+ * A list with a fixed capacity stored inside the object, for the move and
+ * square lists of the hot paths: filling, copying or returning one never
+ * allocates. Only the used part is copied. Exceeding the capacity is a bug,
+ * the capacities are chosen so that no legal position can reach them, and
+ * debug builds assert it.
+ *
+ * Limited to trivially copyable items, which are left uninitialized until
+ * they are added.
+ */
+template <typename T, size_t CAPACITY>
+class InlineList {
+  static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+
+  size_t length = 0;
+  union {
+    T items[CAPACITY];
+  };
+
+ public:
+  using value_type = T;
+
+  InlineList() {}
+
+  InlineList(const InlineList &other) : length(other.length) {
+    memcpy(items, other.items, length * sizeof(T));
+  }
+
+  InlineList &operator=(const InlineList &other) {
+    length = other.length;
+    memcpy(items, other.items, length * sizeof(T));
+    return *this;
+  }
+
+  constexpr size_t size() const {
+    return length;
+  }
+
+  static constexpr size_t capacity() {
+    return CAPACITY;
+  }
+
+  constexpr bool empty() const {
+    return length == 0;
+  }
+
+  constexpr T *begin() {
+    return items;
+  }
+
+  constexpr T *end() {
+    return items + length;
+  }
+
+  constexpr const T *begin() const {
+    return items;
+  }
+
+  constexpr const T *end() const {
+    return items + length;
+  }
+
+  constexpr T &operator[](const size_t index) {
+    return items[index];
+  }
+
+  constexpr const T &operator[](const size_t index) const {
+    return items[index];
+  }
+
+  constexpr void clear() {
+    length = 0;
+  }
+
+  constexpr void push_back(const T &item) {
+    assert(length < CAPACITY);
+    items[length++] = item;
+  }
+
+  template <typename... Args>
+  constexpr T &emplace_back(Args &&...args) {
+    assert(length < CAPACITY);
+    return items[length++] = T(std::forward<Args>(args)...);
+  }
+
+  /** Removes the items that match, keeping the others in order */
+  template <typename Predicate>
+  friend constexpr size_t erase_if(InlineList &list, Predicate predicate) {
+    size_t kept = 0;
+    for (size_t i = 0; i < list.length; ++i) {
+      if (!predicate(list.items[i])) {
+        list.items[kept++] = list.items[i];
+      }
+    }
+    return list.length - std::exchange(list.length, kept);
+  }
+};
@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "server.h"
+
+using namespace std;
+
+/**
+ * Load generator for 'chess --serve': plays random games on many
+ * connections at once and reports the move latency and throughput the
+ * clients see. Every game always has exactly one command in flight, so the
+ * number of games is the concurrency. Each connection is a thread with a
+ * blocking socket that pipelines the commands of its games; the latency of
+ * a move is the time from sending it to reading its reply.
+ */
+
+constexpr char USAGE_TEXT[] =
+    ("Usage: chess-load <socket> [--games <n>] [--connections <n>] [--seconds <s>]\n"
+     "  --games <n>        games played at the same time, default 1000\n"
+     "  --connections <n>  connections (and threads) they are spread over, "
+     "default 4\n"
+     "  --seconds <s>      how long to play, default 5\n");
+
+/** Games are resigned after this many plies, so they don't go on forever */
+constexpr size_t MAX_PLIES = 200;
+
+int connect_to(const string &path) {
+  sockaddr_un address = {.sun_family = AF_UNIX, .sun_path = {}};
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw "The socket path '" + path + "' is too long.";
+  }
+  ranges::copy(path, address.sun_path);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0
+      || connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+    const string reason = strerror(errno);
+    if (fd >= 0) {
+      close(fd);
+    }
+    throw "Can't connect to '" + path + "': " + reason;
+  }
+  return fd;
+}
+
+struct ClientResult {
+  /** Nanoseconds from sending each move to its reply */
+  vector<uint64_t> latencies = {};
+  uint64_t games = 0;
+  uint64_t errors = 0;
+};
+
+/** One connection playing its share of the games until the deadline */
+class LoadClient {
+  enum class Command { NEW, MOVE, RESIGN };
+
+  struct ClientGame {
+    string id = "";
+    /** The same game as on the server, to choose legal moves */
+    Game game = {};
+  };
+
+  struct Pending {
+    size_t game;
+    Command command;
+    chrono::steady_clock::time_point sent;
+  };
+
+  int fd;
+  vector<ClientGame> games;
+  mt19937 random;
+  deque<Pending> pending;
+  string output;
+
+  void request(const size_t index, const Command command) {
+    ClientGame &game = games[index];
+    if (command == Command::NEW) {
+      game.game = Game();
+      output += "new\n";
+    } else if (command == Command::RESIGN) {
+      output += "resign " + game.id + "\n";
+    } else {
+      const MoveList moves = generate_moves(game.game);
+      const Move move = moves[random() % moves.size()];
+      output += "move " + game.id + " " + encode_move(game.game, move) + "\n";
+      apply_move(game.game, move);
+    }
+    pending.push_back({index, command, chrono::steady_clock::now()});
+  }
+
+  void send_output() {
+    for (size_t sent = 0; sent < output.size();) {
+      const ssize_t count =
+          send(fd, output.data() + sent, output.size() - sent, MSG_NOSIGNAL);
+      if (count < 0 && errno != EINTR) {
+        throw string("Lost the connection: ") + strerror(errno);
+      }
+      sent += max<ssize_t>(count, 0);
+    }
+    output.clear();
+  }
+
+  /** Handle the reply to the oldest command and send the game's next one */
+  void on_reply(const string_view reply, const bool stopping, ClientResult &result) {
+    const Pending request = pending.front();
+    pending.pop_front();
+    const auto now = chrono::steady_clock::now();
+    ClientGame &game = games[request.game];
+    if (!reply.starts_with("ok")) {
+      // out of step with the server, start over with a new game, unless
+      // the server refused that already
+      ++result.errors;
+      if (!stopping && request.command != Command::NEW) {
+        this->request(request.game, Command::NEW);
+      }
+      return;
+    }
+    switch (request.command) {
+      case Command::NEW:
+        game.id = reply.substr(3);
+        ++result.games;
+        break;
+      case Command::MOVE:
+        result.latencies.push_back(
+            chrono::duration_cast<chrono::nanoseconds>(now - request.sent).count()
+        );
+        break;
+      case Command::RESIGN:
+        break;
+    }
+    if (stopping) {
+      return;
+    }
+    const bool over = request.command == Command::MOVE && !reply.ends_with(" *");
+    if (request.command == Command::RESIGN) {
+      this->request(request.game, Command::NEW);
+    } else if (over || game.game.history.size() >= MAX_PLIES) {
+      this->request(request.game, Command::RESIGN);
+    } else {
+      this->request(request.game, Command::MOVE);
+    }
+  }
+
+ public:
+  LoadClient(const string &path, const size_t games, const uint32_t seed)
+      : fd(connect_to(path)), games(games), random(seed) {}
+
+  LoadClient(const LoadClient &) = delete;
+  LoadClient &operator=(const LoadClient &) = delete;
+
+  ~LoadClient() {
+    close(fd);
+  }
+
+  ClientResult run(const chrono::steady_clock::time_point deadline) {
+    ClientResult result;
+    for (size_t i = 0; i < games.size(); ++i) {
+      request(i, Command::NEW);
+    }
+    send_output();
+
+    string input;
+    char buffer[1 << 16];
+    while (!pending.empty()) {
+      const ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+      if (count <= 0) {
+        if (count < 0 && errno == EINTR) {
+          continue;
+        }
+        throw string("The server closed the connection.");
+      }
+      input.append(buffer, count);
+      const bool stopping = chrono::steady_clock::now() >= deadline;
+      size_t start = 0;
+      for (size_t end; (end = input.find('\n', start)) != string::npos;
+           start = end + 1) {
+        on_reply(string_view(input).substr(start, end - start), stopping, result);
+      }
+      input.erase(0, start);
+      send_output();
+    }
+    return result;
+  }
+};
+
+int main(int argc, char *argv[]) {
+  const vector<string> args(argv + 1, argv + argc);
+  string path = "";
+  size_t games = 1000;
+  size_t connections = 4;
+  double seconds = 5;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--games" && i + 1 < args.size()) {
+      games = max(1, atoi(args[++i].c_str()));
+    } else if (args[i] == "--connections" && i + 1 < args.size()) {
+      connections = max(1, atoi(args[++i].c_str()));
+    } else if (args[i] == "--seconds" && i + 1 < args.size()) {
+      seconds = max(0.1, atof(args[++i].c_str()));
+    } else if (path.empty() && !args[i].starts_with("-")) {
+      path = args[i];
+    } else {
+      cerr << USAGE_TEXT;
+      return args[i] == "--help" ? 0 : 1;
+    }
+  }
+  if (path.empty()) {
+    cerr << USAGE_TEXT;
+    return 1;
+  }
+  connections = min(connections, games);
+  const size_t needed =
+      (games + MAX_GAMES_PER_CONNECTION - 1) / MAX_GAMES_PER_CONNECTION;
+  if (connections < needed) {
+    cerr << "Using " << needed << " connections, the server allows "
+         << MAX_GAMES_PER_CONNECTION << " games on each." << endl;
+    connections = needed;
+  }
+
+  vector<unique_ptr<LoadClient>> clients;
+  try {
+    for (size_t i = 0; i < connections; ++i) {
+      const size_t share = games / connections + (i < games % connections);
+      clients.push_back(make_unique<LoadClient>(path, share, i + 1));
+    }
+  } catch (string err) {
+    cerr << err << endl;
+    return 1;
+  }
+
+  const auto start = chrono::steady_clock::now();
+  const auto deadline =
+      start + chrono::duration_cast<chrono::steady_clock::duration>(
+                  chrono::duration<double>(seconds)
+              );
+  vector<ClientResult> results(connections);
+  vector<string> failures(connections);
+  vector<thread> threads;
+  for (size_t i = 0; i < connections; ++i) {
+    threads.emplace_back([&, i] {
+      try {
+        results[i] = clients[i]->run(deadline);
+      } catch (string err) {
+        failures[i] = err;
+      }
+    });
+  }
+  for (thread &thread : threads) {
+    thread.join();
+  }
+  const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  for (const string &failure : failures) {
+    if (!failure.empty()) {
+      cerr << failure << endl;
+      return 1;
+    }
+  }
+
+  ClientResult total;
+  for (const ClientResult &result : results) {
+    total.latencies.insert(
+        total.latencies.end(), result.latencies.begin(), result.latencies.end()
+    );
+    total.games += result.games;
+    total.errors += result.errors;
+  }
+  ranges::sort(total.latencies);
+  const auto percentile = [&total](const double fraction) {
+    if (total.latencies.empty()) {
+      return 0.0;
+    }
+    const size_t index = min(
+        total.latencies.size() - 1, size_t(fraction * total.latencies.size())
+    );
+    return total.latencies[index] / 1e3;
+  };
+
+  cout << "Concurrent games: " << games << " on " << connections
+       << " connections\nGames started: " << total.games
+       << "\nMoves: " << total.latencies.size() << " in " << fixed << setprecision(2)
+       << elapsed.count() << " s (" << setprecision(0)
+       << total.latencies.size() / elapsed.count() << " moves/s)\n"
+       << "Move latency: p50 " << setprecision(1) << percentile(0.5) << " µs, p99 "
+       << percentile(0.99) << " µs, max " << percentile(1) << " µs\n"
+       << "Errors: " << total.errors << defaultfloat << endl;
+  return total.errors ? 1 : 0;
+}
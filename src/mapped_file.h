@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Read-only memory mapping of a whole file */
+class MappedFile {
+  const char *data = nullptr;
+  size_t size = 0;
+
+ public:
+  explicit MappedFile(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::string("Can't open '") + path + "': " + strerror(errno);
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+      close(fd);
+      throw std::string("Can't read '") + path + "': " + strerror(errno);
+    }
+    size = info.st_size;
+    if (size > 0) {
+      void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+        close(fd);
+        throw std::string("Can't map '") + path + "': " + strerror(errno);
+      }
+      data = static_cast<const char *>(mapped);
+    }
+    close(fd);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    if (data) {
+      munmap(const_cast<char *>(data), size);
+    }
+  }
+
+  std::string_view view() const {
+    return {data, size};
+  }
+
+  /** Hint that the file will be read front to back, once. */
+  void advise_sequential() const {
+    if (data) {
+      madvise(const_cast<char *>(data), size, MADV_SEQUENTIAL);
+    }
+  }
+
+  /**
+   * Drop the pages before the given offset from this process' memory. They
+   * are read from the file again if accessed later.
+   */
+  void release(const size_t end) const {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t length = end / page * page;
+    if (data && length) {
+      madvise(const_cast<char *>(data), length, MADV_DONTNEED);
+    }
+  }
+};
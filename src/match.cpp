@@ -0,0 +1,519 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "chesscore.h"
+
+using namespace std;
+
+/**
+ * Play many games between two configurations of the engine on all cores, to
+ * tell whether a change makes it stronger. Every opening is played twice
+ * with the colors swapped, and the results of such pairs give the Elo
+ * difference and a sequential probability ratio test (SPRT) that stops the
+ * match once it can decide between two hypotheses.
+ *
+ * Each thread plays one game at a time with a single search thread per
+ * engine and its own hash tables, and only counters are kept of finished
+ * games, so memory use does not grow with the number of games.
+ */
+
+constexpr char USAGE_TEXT[] =
+    ("Usage: chess-match [--games <n>] [--threads <n>] [--nodes <n> | --movetime <ms>]\n"
+     "                   [--engine1 <options>] [--engine2 <options>] [--openings <file>]\n"
+     "                   [--pgn <file>] [--sprt <elo0> <elo1>] [--alpha <a>] [--beta <b>]\n"
+     "  --games <n>          games to play, in pairs with colors swapped, default 1000\n"
+     "  --threads <n>        games played at once, defaults to all cores\n"
+     "  --nodes <n>          nodes per move for both engines, default 5000\n"
+     "  --movetime <ms>      time per move for both engines instead\n"
+     "  --engine1 <options>  comma separated settings of the first engine, e.g.\n"
+     "                       name=new,eval=net.bin,hash=16,nodes=8000,movetime=50\n"
+     "  --engine2 <options>  the same for the second engine\n"
+     "  --openings <file>    start positions, one FEN or EPD per line; by default\n"
+     "                       each pair starts after 8 random plies\n"
+     "  --pgn <file>         write all games to the file\n"
+     "  --sprt <elo0> <elo1> test H0: elo = elo0 against H1: elo = elo1 and stop\n"
+     "                       as soon as one is accepted\n"
+     "  --alpha <a>          probability of accepting H1 when H0 holds, default 0.05\n"
+     "  --beta <b>           probability of accepting H0 when H1 holds, default 0.05\n"
+     "  --max-plies <n>      adjudicate a draw after this many plies, default 400\n");
+
+constexpr size_t RANDOM_OPENING_PLIES = 8;
+/** The variance of fewer pairs is too rough for the SPRT to decide on */
+constexpr size_t SPRT_MIN_PAIRS = 20;
+/** Print the standings after this many games */
+constexpr size_t REPORT_INTERVAL = 100;
+
+struct EngineConfig {
+  string name;
+  optional<string> network_path = nullopt;
+  /** Unset limits are taken from --nodes or --movetime */
+  optional<uint64_t> nodes = nullopt;
+  optional<chrono::milliseconds> movetime = nullopt;
+  size_t hash_megabytes = 16;
+  unique_ptr<Network> network = nullptr;
+};
+
+/** Parse settings such as "name=new,eval=net.bin,nodes=8000" */
+void parse_engine_options(EngineConfig &engine, const string &options) {
+  istringstream stream(options);
+  string option;
+  while (getline(stream, option, ',')) {
+    const size_t equals = option.find('=');
+    const string key = option.substr(0, equals);
+    const string value = equals == string::npos ? "" : option.substr(equals + 1);
+    if (value.empty()) {
+      throw "Engine option '" + option + "' needs a value.";
+    }
+    if (key == "name") {
+      engine.name = value;
+    } else if (key == "eval") {
+      engine.network_path = value;
+    } else if (key == "nodes") {
+      engine.nodes = max(1ll, atoll(value.c_str()));
+    } else if (key == "movetime") {
+      engine.movetime = chrono::milliseconds(max(1, atoi(value.c_str())));
+    } else if (key == "hash") {
+      engine.hash_megabytes = max(1, atoi(value.c_str()));
+    } else {
+      throw "Unknown engine option '" + key + "'.";
+    }
+  }
+}
+
+/** FEN lines as they are, EPD lines without their operations */
+vector<string> read_openings(const string &path) {
+  ifstream file(path);
+  if (!file) {
+    throw "Can't open '" + path + "'.";
+  }
+  vector<string> openings;
+  string line;
+  for (size_t number = 1; getline(file, line); ++number) {
+    istringstream stream(line);
+    vector<string> fields;
+    for (string field; fields.size() < 6 && stream >> field;) {
+      fields.push_back(field);
+    }
+    if (fields.size() < 4 || fields[0].starts_with('#')) {
+      continue;
+    }
+    const bool counters = fields.size() == 6
+                       && ranges::all_of(fields[4] + fields[5], ::isdigit);
+    string fen = fields[0];
+    for (size_t i = 1; i < (counters ? 6 : 4); ++i) {
+      fen += " " + fields[i];
+    }
+    try {
+      parse_fen(fen);
+    } catch (string err) {
+      throw path + ", line " + to_string(number) + ": " + err;
+    }
+    openings.push_back(fen);
+  }
+  if (openings.empty()) {
+    throw "No positions in '" + path + "'.";
+  }
+  return openings;
+}
+
+/** Position after a few random moves, the same for the same pair */
+string random_opening(const size_t pair) {
+  mt19937 random(pair);
+  while (true) {
+    Game game;
+    for (size_t ply = 0; ply < RANDOM_OPENING_PLIES; ++ply) {
+      const MoveList moves = generate_moves(game);
+      if (moves.empty()) {
+        break;
+      }
+      apply_move(game, moves[random() % moves.size()]);
+    }
+    if (has_legal_moves(game)) {
+      return to_fen(game);
+    }
+  }
+}
+
+struct PlayedGame {
+  size_t round;
+  string fen;
+  bool engine1_white;
+  vector<Move> moves;
+  /** "1-0", "0-1" or "1/2-1/2" */
+  string result;
+  string termination;
+};
+
+/** Play a game from the opening to its end, or a draw after max_plies */
+PlayedGame play_game(
+    const size_t round,
+    const string &fen,
+    const bool engine1_white,
+    const array<const EngineConfig *, 2> &engines,
+    const array<TranspositionTable *, 2> &tables,
+    const SearchLimits &defaults,
+    const size_t max_plies
+) {
+  PlayedGame played = {round, fen, engine1_white, {}, "1/2-1/2", ""};
+  Game game = parse_fen(fen);
+  tables[0]->clear();
+  tables[1]->clear();
+  while (true) {
+    if (!has_legal_moves(game)) {
+      if (game.threats.checkers) {
+        played.result = game.turn ? "0-1" : "1-0";
+        played.termination = "checkmate";
+      } else {
+        played.termination = "stalemate";
+      }
+      break;
+    }
+    if (game.halfmove_clock >= 100) {
+      played.termination = "fifty-move rule";
+      break;
+    }
+    if (is_threefold_repetition(game)) {
+      played.termination = "threefold repetition";
+      break;
+    }
+    if (is_insufficient_material(game.board)) {
+      played.termination = "insufficient material";
+      break;
+    }
+    if (played.moves.size() >= max_plies) {
+      played.termination = "adjudicated after " + to_string(max_plies) + " plies";
+      break;
+    }
+
+    // engines[0] is engine 1
+    const size_t side = game.turn == engine1_white ? 0 : 1;
+    const EngineConfig &engine = *engines[side];
+    SearchLimits limits = defaults;
+    if (engine.nodes || engine.movetime) {
+      limits.nodes = engine.nodes;
+      limits.movetime = engine.movetime;
+    }
+    attach_network(game, engine.network.get());
+    const SearchReport report = parallel_search(
+        game, *tables[side], limits, 1, nullptr, [](const SearchReport &) {}
+    );
+    const Move move = report.pv.empty() ? generate_moves(game)[0] : report.pv.front();
+    apply_move(game, move);
+    played.moves.push_back(move);
+  }
+  return played;
+}
+
+string format_pgn(const PlayedGame &game, const string &white, const string &black) {
+  ostringstream pgn;
+  pgn << "[Event \"chess-match\"]\n[Round \"" << game.round << "\"]\n[White \""
+      << white << "\"]\n[Black \"" << black << "\"]\n[Result \"" << game.result
+      << "\"]\n[FEN \"" << game.fen << "\"]\n[SetUp \"1\"]\n[PlyCount \""
+      << game.moves.size() << "\"]\n[Termination \"" << game.termination << "\"]\n\n";
+  Game replay = parse_fen(game.fen);
+  string line = "";
+  const auto add = [&](const string &word) {
+    if (!line.empty() && line.size() + 1 + word.size() > 79) {
+      pgn << line << "\n";
+      line.clear();
+    }
+    line += (line.empty() ? "" : " ") + word;
+  };
+  for (size_t i = 0; i < game.moves.size(); ++i) {
+    if (replay.turn || i == 0) {
+      add(to_string(replay.fullmove_number) + (replay.turn ? "." : "..."));
+    }
+    add(encode_move(replay, game.moves[i]));
+    apply_move(replay, game.moves[i]);
+  }
+  add(game.result);
+  pgn << line << "\n\n";
+  return pgn.str();
+}
+
+/**
+ * Results from the first engine's point of view. Pairs of games with the
+ * same opening are counted by their total score of 0, ½, 1, 1½ or 2 points
+ * (the pentanomial distribution): the two games of a pair are correlated
+ * through the opening, so their sum has less variance than two independent
+ * games, which makes the error bars and the SPRT both correct and tighter.
+ */
+struct MatchStatistics {
+  uint64_t wins = 0;
+  uint64_t draws = 0;
+  uint64_t losses = 0;
+  /** Pairs by the engine's points times two */
+  array<uint64_t, 5> pairs = {};
+
+  uint64_t games() const {
+    return wins + draws + losses;
+  }
+
+  uint64_t pair_count() const {
+    return pairs[0] + pairs[1] + pairs[2] + pairs[3] + pairs[4];
+  }
+
+  /** Mean score per game and the variance of a pair's mean score */
+  pair<double, double> score() const {
+    const double count = pair_count();
+    double mean = 0, variance = 0;
+    for (size_t i = 0; i < 5; ++i) {
+      mean += pairs[i] * (i / 4.0) / count;
+    }
+    for (size_t i = 0; i < 5; ++i) {
+      variance += pairs[i] * pow(i / 4.0 - mean, 2) / count;
+    }
+    return {mean, variance};
+  }
+
+  static double elo(const double score) {
+    const double clamped = clamp(score, 1e-6, 1 - 1e-6);
+    return -400 * log10(1 / clamped - 1);
+  }
+
+  static double expected_score(const double elo) {
+    return 1 / (1 + pow(10, -elo / 400));
+  }
+
+  /** Elo difference and the half width of its 95% confidence interval */
+  pair<double, double> elo_estimate() const {
+    const auto [mean, variance] = score();
+    const double margin = 1.959964 * sqrt(variance / pair_count());
+    return {elo(mean), (elo(mean + margin) - elo(mean - margin)) / 2};
+  }
+
+  /**
+   * Log-likelihood ratio of elo1 against elo0, in the normal approximation
+   * of the generalised SPRT used by Fishtest: the observed pair scores are
+   * treated as normally distributed with their observed variance.
+   */
+  double log_likelihood_ratio(const double elo0, const double elo1) const {
+    const auto [mean, variance] = score();
+    if (pair_count() == 0 || variance <= 0) {
+      return 0;
+    }
+    const double score0 = expected_score(elo0);
+    const double score1 = expected_score(elo1);
+    return pair_count() * (score1 - score0) * (2 * mean - score0 - score1)
+         / (2 * variance);
+  }
+};
+
+struct Sprt {
+  double elo0;
+  double elo1;
+  double alpha = 0.05;
+  double beta = 0.05;
+
+  double lower_bound() const {
+    return log(beta / (1 - alpha));
+  }
+
+  double upper_bound() const {
+    return log((1 - beta) / alpha);
+  }
+};
+
+void print_standings(
+    const MatchStatistics &statistics, const optional<Sprt> &sprt, const bool final
+) {
+  cout << (final ? "\nGames: " : "Games: ") << statistics.games() << "  +"
+       << statistics.wins << " =" << statistics.draws << " -" << statistics.losses;
+  if (statistics.pair_count()) {
+    const auto [elo, margin] = statistics.elo_estimate();
+    cout << fixed << setprecision(1) << "  Elo " << elo << " +/- " << margin;
+    if (sprt) {
+      cout << setprecision(2) << "  LLR "
+           << statistics.log_likelihood_ratio(sprt->elo0, sprt->elo1) << " ["
+           << sprt->lower_bound() << ", " << sprt->upper_bound() << "]";
+    }
+    cout << defaultfloat;
+  }
+  cout << endl;
+  if (final) {
+    cout << "Pairs (0, 1/2, 1, 3/2, 2 points):";
+    for (const uint64_t count : statistics.pairs) {
+      cout << " " << count;
+    }
+    cout << endl;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const vector<string> args(argv + 1, argv + argc);
+  size_t games = 1000;
+  size_t threads = max(1u, thread::hardware_concurrency());
+  SearchLimits defaults = {.nodes = 5000};
+  array<EngineConfig, 2> engines = {EngineConfig{"engine1"}, EngineConfig{"engine2"}};
+  array<string, 2> engine_options = {"", ""};
+  optional<string> openings_path = nullopt;
+  optional<string> pgn_path = nullopt;
+  optional<Sprt> sprt = nullopt;
+  double alpha = 0.05, beta = 0.05;
+  size_t max_plies = 400;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--games" && i + 1 < args.size()) {
+      games = max(1, atoi(args[++i].c_str()));
+    } else if (args[i] == "--threads" && i + 1 < args.size()) {
+      threads = max(1, atoi(args[++i].c_str()));
+    } else if (args[i] == "--nodes" && i + 1 < args.size()) {
+      defaults.nodes = max(1ll, atoll(args[++i].c_str()));
+      defaults.movetime = nullopt;
+    } else if (args[i] == "--movetime" && i + 1 < args.size()) {
+      defaults.movetime = chrono::milliseconds(max(1, atoi(args[++i].c_str())));
+      defaults.nodes = nullopt;
+    } else if (args[i] == "--engine1" && i + 1 < args.size()) {
+      engine_options[0] = args[++i];
+    } else if (args[i] == "--engine2" && i + 1 < args.size()) {
+      engine_options[1] = args[++i];
+    } else if (args[i] == "--openings" && i + 1 < args.size()) {
+      openings_path = args[++i];
+    } else if (args[i] == "--pgn" && i + 1 < args.size()) {
+      pgn_path = args[++i];
+    } else if (args[i] == "--sprt" && i + 2 < args.size()) {
+      sprt = Sprt{atof(args[i + 1].c_str()), atof(args[i + 2].c_str())};
+      i += 2;
+    } else if (args[i] == "--alpha" && i + 1 < args.size()) {
+      alpha = clamp(atof(args[++i].c_str()), 1e-6, 0.5);
+    } else if (args[i] == "--beta" && i + 1 < args.size()) {
+      beta = clamp(atof(args[++i].c_str()), 1e-6, 0.5);
+    } else if (args[i] == "--max-plies" && i + 1 < args.size()) {
+      max_plies = max(1, atoi(args[++i].c_str()));
+    } else {
+      cerr << USAGE_TEXT;
+      return args[i] == "--help" ? 0 : 1;
+    }
+  }
+  if (sprt) {
+    sprt->alpha = alpha;
+    sprt->beta = beta;
+  }
+  // whole pairs only
+  games += games % 2;
+
+  vector<string> openings;
+  ofstream pgn;
+  try {
+    for (size_t i = 0; i < 2; ++i) {
+      parse_engine_options(engines[i], engine_options[i]);
+      if (engines[i].network_path) {
+        engines[i].network = load_network(*engines[i].network_path);
+      }
+    }
+    if (openings_path) {
+      openings = read_openings(*openings_path);
+    }
+    if (pgn_path) {
+      pgn.open(*pgn_path);
+      if (!pgn) {
+        throw "Can't write '" + *pgn_path + "'.";
+      }
+    }
+  } catch (string err) {
+    cerr << err << endl;
+    return 1;
+  }
+
+  cout << engines[0].name << " against " << engines[1].name << ", " << games
+       << " games on " << threads << " threads" << endl;
+  const auto start = chrono::steady_clock::now();
+  atomic<size_t> next_game = 0;
+  // lowered to the end of the pairs already started once the SPRT decides
+  atomic<size_t> end_game = games;
+  mutex lock;
+  MatchStatistics statistics;
+  // first results of pairs whose second game is still running
+  unordered_map<size_t, uint8_t> open_pairs;
+
+  const auto record = [&](const PlayedGame &game) {
+    // points of engine 1 times two
+    const uint8_t points = game.result == "1/2-1/2"         ? 1
+                         : (game.result == "1-0") == game.engine1_white ? 2
+                                                                        : 0;
+    const string &white = engines[!game.engine1_white].name;
+    const string &black = engines[game.engine1_white].name;
+    const string text = pgn_path ? format_pgn(game, white, black) : "";
+
+    lock_guard guard(lock);
+    (points == 2 ? statistics.wins : points == 1 ? statistics.draws : statistics.losses)++;
+    const size_t pair = (game.round - 1) / 2;
+    const auto partner = open_pairs.find(pair);
+    if (partner == open_pairs.end()) {
+      open_pairs.emplace(pair, points);
+    } else {
+      ++statistics.pairs[partner->second + points];
+      open_pairs.erase(partner);
+      if (sprt && statistics.pair_count() >= SPRT_MIN_PAIRS) {
+        const double llr = statistics.log_likelihood_ratio(sprt->elo0, sprt->elo1);
+        if (llr <= sprt->lower_bound() || llr >= sprt->upper_bound()) {
+          end_game = min(end_game.load(), (next_game.load() + 1) / 2 * 2);
+        }
+      }
+    }
+    if (pgn_path) {
+      pgn << text << flush;
+    }
+    if (statistics.games() % REPORT_INTERVAL == 0) {
+      print_standings(statistics, sprt, false);
+    }
+  };
+
+  vector<thread> workers;
+  for (size_t i = 0; i < min(threads, games); ++i) {
+    workers.emplace_back([&] {
+      array<unique_ptr<TranspositionTable>, 2> tables = {
+          make_unique<TranspositionTable>(engines[0].hash_megabytes),
+          make_unique<TranspositionTable>(engines[1].hash_megabytes),
+      };
+      const array<const EngineConfig *, 2> players = {&engines[0], &engines[1]};
+      while (true) {
+        const size_t index = next_game++;
+        if (index >= end_game) {
+          return;
+        }
+        const size_t pair = index / 2;
+        const string fen = openings.empty() ? random_opening(pair)
+                                            : openings[pair % openings.size()];
+        record(play_game(
+            index + 1, fen, index % 2 == 0, players, {tables[0].get(), tables[1].get()},
+            defaults, max_plies
+        ));
+      }
+    });
+  }
+  for (thread &worker : workers) {
+    worker.join();
+  }
+
+  const chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+  print_standings(statistics, sprt, true);
+  if (sprt) {
+    const double llr = statistics.pair_count() >= SPRT_MIN_PAIRS
+                         ? statistics.log_likelihood_ratio(sprt->elo0, sprt->elo1)
+                         : 0;
+    cout << "SPRT (" << sprt->elo0 << ", " << sprt->elo1 << "): "
+         << (llr >= sprt->upper_bound()   ? "H1 accepted"
+             : llr <= sprt->lower_bound() ? "H0 accepted"
+                                          : "inconclusive")
+         << endl;
+  }
+  cout << "Time: " << fixed << setprecision(1) << seconds.count() << " s ("
+       << setprecision(2) << statistics.games() / seconds.count() << " games/s)"
+       << defaultfloat << endl;
+  return 0;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+/**
+ * The efficiently updatable neural network that evaluates positions: its
+ * weights and the kernels that update and read out an Accumulator, with
+ * AVX2 or SSE4.1 where the build allows and portable code otherwise.
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "board.h"
+
+#if defined(__SSE4_1__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/** Inputs of the network: one per color, piece type and square */
+constexpr size_t NNUE_FEATURES = 2 * 6 * 64;
+/** Activations of the first layer are clipped to 0..NNUE_CLIP */
+constexpr int16_t NNUE_CLIP = 255;
+/** The output neuron's sum is divided by this to give centipawns */
+constexpr int32_t NNUE_OUTPUT_SCALE = 64;
+
+/**
+ * Weights of a small efficiently updatable neural network. The first layer
+ * sees the board from both sides – own pieces first, the board flipped for
+ * Black – and its sums only change by one row of weights for every piece
+ * that is put or removed, so apply_move keeps them up to date in an
+ * Accumulator. The output neuron weights the clipped sums of the side to
+ * move and of the other side.
+ */
+struct Network {
+  alignas(64) std::array<std::array<int16_t, NNUE_HIDDEN>, NNUE_FEATURES> feature_weights;
+  alignas(64) std::array<int16_t, NNUE_HIDDEN> feature_bias;
+  /** For the side to move and for the other side */
+  alignas(64) std::array<std::array<int16_t, NNUE_HIDDEN>, 2> output_weights;
+  int32_t output_bias;
+};
+
+constexpr size_t nnue_feature(
+    const Color perspective, const ColorPiece &piece, const uint8_t square
+) {
+  return (piece.color == perspective ? 0 : 6 * 64) + piece.piece * 64
+       + (perspective ? square : square ^ 56);
+}
+
+#if defined(__AVX2__)
+constexpr char NNUE_SIMD[] = "AVX2";
+#elif defined(__SSE4_1__)
+constexpr char NNUE_SIMD[] = "SSE4.1";
+#else
+constexpr char NNUE_SIMD[] = "";
+#endif
+
+// The kernels take simd = false to run the portable code on any build, so
+// both can be compared. All of them wrap around on overflow like the
+// instructions do, which keeps the results bit-identical.
+
+template <bool simd = true>
+void add_weights(int16_t *values, const int16_t *weights) {
+#if defined(__AVX2__)
+  if constexpr (simd) {
+    for (size_t i = 0; i < NNUE_HIDDEN; i += 16) {
+      __m256i *target = reinterpret_cast<__m256i *>(values + i);
+      const __m256i row = _mm256_load_si256(reinterpret_cast<const __m256i *>(weights + i));
+      _mm256_store_si256(target, _mm256_add_epi16(_mm256_load_si256(target), row));
+    }
+    return;
+  }
+#elif defined(__SSE4_1__)
+  if constexpr (simd) {
+    for (size_t i = 0; i < NNUE_HIDDEN; i += 8) {
+      __m128i *target = reinterpret_cast<__m128i *>(values + i);
+      const __m128i row = _mm_load_si128(reinterpret_cast<const __m128i *>(weights + i));
+      _mm_store_si128(target, _mm_add_epi16(_mm_load_si128(target), row));
+    }
+    return;
+  }
+#endif
+  for (size_t i = 0; i < NNUE_HIDDEN; ++i) {
+    values[i] += weights[i];
+  }
+}
+
+template <bool simd = true>
+void subtract_weights(int16_t *values, const int16_t *weights) {
+#if defined(__AVX2__)
+  if constexpr (simd) {
+    for (size_t i = 0; i < NNUE_HIDDEN; i += 16) {
+      __m256i *target = reinterpret_cast<__m256i *>(values + i);
+      const __m256i row = _mm256_load_si256(reinterpret_cast<const __m256i *>(weights + i));
+      _mm256_store_si256(target, _mm256_sub_epi16(_mm256_load_si256(target), row));
+    }
+    return;
+  }
+#elif defined(__SSE4_1__)
+  if constexpr (simd) {
+    for (size_t i = 0; i < NNUE_HIDDEN; i += 8) {
+      __m128i *target = reinterpret_cast<__m128i *>(values + i);
+      const __m128i row = _mm_load_si128(reinterpret_cast<const __m128i *>(weights + i));
+      _mm_store_si128(target, _mm_sub_epi16(_mm_load_si128(target), row));
+    }
+    return;
+  }
+#endif
+  for (size_t i = 0; i < NNUE_HIDDEN; ++i) {
+    values[i] -= weights[i];
+  }
+}
+
+/** Output neuron before scaling: clipped sums times weights plus bias */
+template <bool simd = true>
+int32_t nnue_output(const Network &network, const Accumulator &accumulator, const Color turn) {
+  const std::array<Color, 2> perspectives = {turn, invert(turn)};
+#if defined(__AVX2__)
+  if constexpr (simd) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i clip = _mm256_set1_epi16(NNUE_CLIP);
+    __m256i sum = zero;
+    for (size_t side = 0; side < 2; ++side) {
+      const int16_t *values = accumulator.values[perspectives[side]].data();
+      const int16_t *weights = network.output_weights[side].data();
+      for (size_t i = 0; i < NNUE_HIDDEN; i += 16) {
+        const __m256i value = _mm256_load_si256(reinterpret_cast<const __m256i *>(values + i));
+        const __m256i clipped = _mm256_min_epi16(_mm256_max_epi16(value, zero), clip);
+        const __m256i weight = _mm256_load_si256(reinterpret_cast<const __m256i *>(weights + i));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(clipped, weight));
+      }
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_hadd_epi32(half, half);
+    half = _mm_hadd_epi32(half, half);
+    return static_cast<int32_t>(
+        static_cast<uint32_t>(_mm_cvtsi128_si32(half)) + static_cast<uint32_t>(network.output_bias)
+    );
+  }
+#elif defined(__SSE4_1__)
+  if constexpr (simd) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i clip = _mm_set1_epi16(NNUE_CLIP);
+    __m128i sum = zero;
+    for (size_t side = 0; side < 2; ++side) {
+      const int16_t *values = accumulator.values[perspectives[side]].data();
+      const int16_t *weights = network.output_weights[side].data();
+      for (size_t i = 0; i < NNUE_HIDDEN; i += 8) {
+        const __m128i value = _mm_load_si128(reinterpret_cast<const __m128i *>(values + i));
+        const __m128i clipped = _mm_min_epi16(_mm_max_epi16(value, zero), clip);
+        const __m128i weight = _mm_load_si128(reinterpret_cast<const __m128i *>(weights + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(clipped, weight));
+      }
+    }
+    sum = _mm_hadd_epi32(sum, sum);
+    sum = _mm_hadd_epi32(sum, sum);
+    return static_cast<int32_t>(
+        static_cast<uint32_t>(_mm_cvtsi128_si32(sum)) + static_cast<uint32_t>(network.output_bias)
+    );
+  }
+#endif
+  uint32_t sum = network.output_bias;
+  for (size_t side = 0; side < 2; ++side) {
+    const int16_t *values = accumulator.values[perspectives[side]].data();
+    const int16_t *weights = network.output_weights[side].data();
+    for (size_t i = 0; i < NNUE_HIDDEN; ++i) {
+      sum += static_cast<uint32_t>(
+          std::clamp<int16_t>(values[i], 0, NNUE_CLIP) * weights[i]
+      );
+    }
+  }
+  return static_cast<int32_t>(sum);
+}
+
+template <bool simd = true>
+void add_feature(
+    Accumulator &accumulator, const Network &network, const ColorPiece &piece, const uint8_t square
+) {
+  for (const Color perspective : {white, black}) {
+    add_weights<simd>(
+        accumulator.values[perspective].data(),
+        network.feature_weights[nnue_feature(perspective, piece, square)].data()
+    );
+  }
+}
+
+template <bool simd = true>
+void subtract_feature(
+    Accumulator &accumulator, const Network &network, const ColorPiece &piece, const uint8_t square
+) {
+  for (const Color perspective : {white, black}) {
+    subtract_weights<simd>(
+        accumulator.values[perspective].data(),
+        network.feature_weights[nnue_feature(perspective, piece, square)].data()
+    );
+  }
+}
+
+/** Sum up the first layer from scratch */
+template <bool simd = true>
+Accumulator refresh_accumulator(const Network &network, const Board &board) {
+  Accumulator accumulator;
+  accumulator.values = {network.feature_bias, network.feature_bias};
+  for (uint8_t square = 0; square < 64; ++square) {
+    if (const std::optional<ColorPiece> &piece = board.mailbox[square]) {
+      add_feature<simd>(accumulator, network, *piece, square);
+    }
+  }
+  return accumulator;
+}
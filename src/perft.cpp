@@ -0,0 +1,37 @@
+#include "perft.h"
+
+#include <ctime>
+
+using namespace std;
+
+uint64_t perft(Game &game, const uint8_t depth, TranspositionTable *table) {
+  if (depth == 0) {
+    return 1;
+  }
+  const MoveList moves = generate_moves(game);
+  if (depth == 1) {
+    return moves.size();
+  }
+  if (table) {
+    const optional<uint64_t> cached = table->probe(game.hash);
+    if (cached && (*cached & 0xff) == depth) {
+      return *cached >> 8;
+    }
+  }
+  uint64_t nodes = 0;
+  for (const Move &move : moves) {
+    const Undo undo = apply_move(game, move);
+    nodes += perft(game, depth - 1, table);
+    undo_move(game, move, undo);
+  }
+  if (table) {
+    table->store(game.hash, nodes << 8 | depth);
+  }
+  return nodes;
+}
+
+chrono::duration<double> thread_cpu_time() {
+  timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return chrono::seconds(time.tv_sec) + chrono::nanoseconds(time.tv_nsec);
+}
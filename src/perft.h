@@ -0,0 +1,170 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "board.h"
+#include "transposition_table.h"
+
+/**
+ * Count the leaf nodes of the legal move tree to the given depth. Subtree
+ * counts are cached in the table, packed as nodes << 8 | depth.
+ */
+uint64_t perft(Game &game, uint8_t depth, TranspositionTable *table = nullptr);
+
+/** CPU time used by the calling thread, excluding time it was not scheduled */
+std::chrono::duration<double> thread_cpu_time();
+
+/**
+ * Parallel perft: subtrees are split into tasks down to PERFT_SPLIT_DEPTH
+ * below which they are counted sequentially. Every thread works off the back
+ * of its own task deque and, once that runs dry, steals from the front of
+ * another thread's deque – the front holds the largest remaining subtrees.
+ */
+class PerftScheduler {
+  static constexpr uint8_t PERFT_SPLIT_DEPTH = 3;
+
+  struct Task {
+    Game game;
+    uint8_t depth;
+    size_t root_move;
+  };
+
+  struct Worker {
+    std::mutex lock;
+    std::deque<Task> tasks;
+    uint64_t nodes = 0;
+    std::chrono::duration<double> busy{0};
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  TranspositionTable *table;
+  std::vector<std::atomic<uint64_t>> root_nodes;
+  std::atomic<size_t> pending = 0;
+  std::chrono::duration<double> elapsed{0};
+
+  std::optional<Task> take(const size_t index) {
+    {
+      Worker &own = *workers[index];
+      std::lock_guard guard(own.lock);
+      if (!own.tasks.empty()) {
+        Task task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return task;
+      }
+    }
+    for (size_t offset = 1; offset < workers.size(); ++offset) {
+      Worker &victim = *workers[(index + offset) % workers.size()];
+      std::lock_guard guard(victim.lock);
+      if (!victim.tasks.empty()) {
+        Task task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return task;
+      }
+    }
+    return std::nullopt;
+  }
+
+  void run(const size_t index) {
+    Worker &worker = *workers[index];
+    while (pending > 0) {
+      std::optional<Task> task = take(index);
+      if (!task) {
+        std::this_thread::yield();
+        continue;
+      }
+      const std::chrono::duration<double> start = thread_cpu_time();
+      if (task->depth > PERFT_SPLIT_DEPTH) {
+        for (const Move &move : generate_moves(task->game)) {
+          Task child = {task->game, uint8(task->depth - 1), task->root_move};
+          apply_move(child.game, move);
+          ++pending;
+          std::lock_guard guard(worker.lock);
+          worker.tasks.push_back(std::move(child));
+        }
+      } else {
+        const uint64_t nodes = perft(task->game, task->depth, table);
+        root_nodes[task->root_move] += nodes;
+        worker.nodes += nodes;
+      }
+      worker.busy += thread_cpu_time() - start;
+      --pending;
+    }
+  }
+
+ public:
+  PerftScheduler(
+      const size_t threads,
+      const size_t root_moves,
+      TranspositionTable *table = nullptr
+  )
+      : table(table), root_nodes(root_moves) {
+    for (size_t i = 0; i < threads; ++i) {
+      workers.push_back(std::make_unique<Worker>());
+    }
+  }
+
+  /** Count each root move's subtree; returns nodes per root move. */
+  std::vector<uint64_t> count(
+      const Game &game, const MoveList &moves, const uint8_t depth
+  ) {
+    for (size_t i = 0; i < moves.size(); ++i) {
+      Task task = {game, uint8(depth - 1), i};
+      apply_move(task.game, moves[i]);
+      workers[i % workers.size()]->tasks.push_back(std::move(task));
+    }
+    pending = moves.size();
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers.size(); ++i) {
+      threads.emplace_back(&PerftScheduler::run, this, i);
+    }
+    run(0);
+    for (std::thread &t : threads) {
+      t.join();
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    return {root_nodes.begin(), root_nodes.end()};
+  }
+
+  /** Wall time of the last count, without setting up the tasks or the table */
+  std::chrono::duration<double> time() const {
+    return elapsed;
+  }
+
+  /**
+   * Print each thread's nodes and the share of the last count it spent on
+   * tasks. Given the time of a single-threaded count of the same tree, also
+   * print the speedup and the efficiency T1 / (N * TN).
+   */
+  void print_thread_stats(
+      const std::optional<std::chrono::duration<double>> &single_thread = std::nullopt
+  ) const {
+    std::chrono::duration<double> busy{0};
+    for (size_t i = 0; i < workers.size(); ++i) {
+      std::cout << "Thread " << i << ": " << workers[i]->nodes << " nodes, "
+           << std::fixed << std::setprecision(1)
+           << 100 * workers[i]->busy / elapsed << "% busy" << std::endl;
+      busy += workers[i]->busy;
+    }
+    // CPU time spent in tasks shows how well the work is distributed, not
+    // whether it got done any faster: memory and cache effects are missed.
+    std::cout << "Utilisation: " << 100 * busy / (workers.size() * elapsed)
+         << "% of " << workers.size() << " threads" << std::endl;
+    if (single_thread) {
+      const double speedup = *single_thread / elapsed;
+      std::cout << "Speedup: " << speedup << "x on " << workers.size()
+           << " threads (" << 100 * speedup / workers.size()
+           << "% efficiency)" << std::endl;
+    }
+    std::cout << std::defaultfloat;
+  }
+};
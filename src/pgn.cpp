@@ -0,0 +1,79 @@
+#include "pgn.h"
+
+using namespace std;
+
+size_t replay_pgn_game(
+    const string_view text,
+    const function<void(const Game &, const Move &)> &on_move
+) {
+  Game game;
+  size_t position = 0;
+  const auto skip_past = [&text, &position](const char end) {
+    position = text.find(end, position);
+    position = position == text.npos ? text.size() : position + 1;
+  };
+
+  while (position < text.size()) {
+    const char c = text[position];
+    if (isspace(c)) {
+      ++position;
+    } else if (c == '[') {  // tag pair
+      const size_t line_end = min(text.find('\n', position), text.size());
+      const string_view tag = text.substr(position, line_end - position);
+      if (tag.starts_with("[FEN \"")) {
+        const size_t value_end = tag.find('"', 6);
+        game = parse_fen(string(tag.substr(6, value_end - 6)));
+      }
+      position = line_end;
+    } else if (c == '{') {
+      skip_past('}');
+    } else if (c == ';' || c == '%') {
+      skip_past('\n');
+    } else if (c == '(') {  // variation, possibly nested
+      for (int depth = 0; position < text.size();) {
+        const char v = text[position++];
+        if (v == '{') {
+          skip_past('}');
+        } else if (v == ';') {
+          skip_past('\n');
+        } else if (v == '(') {
+          ++depth;
+        } else if (v == ')' && --depth == 0) {
+          break;
+        }
+      }
+    } else {
+      const size_t end = min(text.find_first_of(" \t\r\n{(;", position), text.size());
+      string_view token = text.substr(position, end - position);
+      position = end;
+      if (token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*") {
+        break;
+      }
+      // Move numbers may stick to the move, e.g. "12.e4" or "12...e5"
+      const size_t digits = token.find_first_not_of("0123456789");
+      if (digits != token.npos && digits > 0 && token[digits] == '.') {
+        const size_t move_start = token.find_first_not_of('.', digits);
+        token.remove_prefix(move_start == token.npos ? token.size() : move_start);
+      }
+      if (token.empty() || token[0] == '$' || token == "e.p.") {
+        continue;
+      }
+      const size_t ply = game.history.size() + 1;
+      try {
+        const Move move = decode_move(game, token);
+        const Undo undo = apply_move(game, move);
+        if (is_in_check(game, invert(game.turn))) {
+          throw string("The King is left in check.");
+        }
+        if (on_move) {
+          undo_move(game, move, undo);
+          on_move(game, move);
+          apply_move(game, move);
+        }
+      } catch (string err) {
+        throw "ply " + std::to_string(ply) + " '" + string(token) + "': " + err;
+      }
+    }
+  }
+  return game.history.size();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string_view>
+
+#include "board.h"
+
+/**
+ * Split Portable Game Notation (PGN) into games without copying. A game ends
+ * where the tag pairs of the next one begin.
+ */
+class PgnReader {
+  std::string_view data;
+  size_t position = 0;
+
+ public:
+  explicit PgnReader(const std::string_view data) : data(data) {}
+
+  size_t offset() const {
+    return position;
+  }
+
+  std::optional<std::string_view> next_game() {
+    const size_t start = position;
+    bool in_movetext = false;
+    while (position < data.size()) {
+      size_t line_end = data.find('\n', position);
+      line_end = line_end == data.npos ? data.size() : line_end + 1;
+      const std::string_view line = data.substr(position, line_end - position);
+      const size_t first = line.find_first_not_of(" \t\r\n");
+      if (first != line.npos) {
+        if (line[first] == '[') {
+          if (in_movetext) {
+            return data.substr(start, position - start);
+          }
+        } else {
+          in_movetext = true;
+        }
+      }
+      position = line_end;
+    }
+    if (start == position
+        || data.substr(start).find_first_not_of(" \t\r\n") == data.npos) {
+      return std::nullopt;
+    }
+    return data.substr(start, position - start);
+  }
+};
+
+/**
+ * Replay the moves of one PGN game. Comments, variations, move numbers and
+ * numeric annotation glyphs are skipped. Returns the number of plies, or
+ * throws a description of the first invalid move. The callback sees every
+ * move together with the position it is played in.
+ */
+size_t replay_pgn_game(
+    std::string_view text,
+    const std::function<void(const Game &, const Move &)> &on_move = nullptr
+);
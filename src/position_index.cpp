@@ -0,0 +1,394 @@
+#include "position_index.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <tuple>
+
+#include "pgn.h"
+
+using namespace std;
+
+/** One move of one game, as collected from the PGN file */
+struct IndexRecord {
+  uint64_t key;
+  uint64_t offset;
+  uint16_t move;
+  /** 0 for a White win, 1 for a draw, 2 for a Black win, 3 if unknown */
+  uint8_t result;
+};
+
+bool by_position(const IndexRecord &a, const IndexRecord &b) {
+  return tie(a.key, a.move, a.offset) < tie(b.key, b.move, b.offset);
+}
+
+void put_varint(string &out, uint64_t value) {
+  for (; value >= 0x80; value >>= 7) {
+    out += static_cast<char>(value | 0x80);
+  }
+  out += static_cast<char>(value);
+}
+
+uint64_t get_varint(const uint8_t *&data, const uint8_t *end) {
+  uint64_t value = 0;
+  for (uint8_t shift = 0; data < end && shift < 64; shift += 7) {
+    const uint8_t byte = *data++;
+    value |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  throw string("The position index is corrupt.");
+}
+
+void put_le(string &out, const uint64_t value) {
+  for (size_t i = 0; i < 8; ++i) {
+    out += static_cast<char>(value >> 8 * i);
+  }
+}
+
+/** Sums up sorted records into entries and writes them in blocks */
+class IndexWriter {
+  ofstream out;
+  string path;
+  IndexSummary summary = {};
+
+  ExploredMove entry = {};
+  uint64_t entry_key = 0;
+  /** Game of the last record added to the entry */
+  uint64_t entry_offset = 0;
+  bool has_entry = false;
+
+  string block = "";
+  size_t block_entries = 0;
+  uint64_t previous_key = 0;
+  uint64_t offset = PositionIndex::HEADER_SIZE;
+  /** First key and offset of every block */
+  vector<pair<uint64_t, uint64_t>> directory = {};
+
+  void flush_block() {
+    if (block_entries == 0) {
+      return;
+    }
+    string count;
+    put_varint(count, block_entries);
+    out << count << block;
+    offset += count.size() + block.size();
+    block.clear();
+    block_entries = 0;
+  }
+
+  void flush_entry() {
+    if (!has_entry) {
+      return;
+    }
+    if (block_entries >= PositionIndex::BLOCK_ENTRIES && entry_key != previous_key) {
+      flush_block();
+    }
+    if (block_entries == 0) {
+      directory.emplace_back(entry_key, offset);
+      previous_key = entry_key;
+    }
+    put_varint(block, entry_key - previous_key);
+    put_varint(block, entry.move.data);
+    put_varint(block, entry.games);
+    put_varint(block, entry.white_wins);
+    put_varint(block, entry.draws);
+    put_varint(block, entry.black_wins);
+    put_varint(block, entry.game_offsets.size());
+    uint64_t previous_offset = 0;
+    for (const uint64_t game_offset : entry.game_offsets) {
+      put_varint(block, game_offset - previous_offset);
+      previous_offset = game_offset;
+    }
+    previous_key = entry_key;
+    ++block_entries;
+    ++summary.entries;
+  }
+
+ public:
+  explicit IndexWriter(const string &path) : out(path, ios::binary), path(path) {
+    if (!out) {
+      throw "Can't write '" + path + "'.";
+    }
+    out << string(PositionIndex::HEADER_SIZE, '\0');
+  }
+
+  /** Records must come sorted by position */
+  void add(const IndexRecord &record) {
+    if (!has_entry || record.key != entry_key || record.move != entry.move.data) {
+      flush_entry();
+      entry = {};
+      entry.move.data = record.move;
+      entry_key = record.key;
+      has_entry = true;
+    } else if (record.offset == entry_offset) {
+      // one game can play the same move from a position twice
+      return;
+    }
+    entry_offset = record.offset;
+    ++entry.games;
+    entry.white_wins += record.result == 0;
+    entry.draws += record.result == 1;
+    entry.black_wins += record.result == 2;
+    if (entry.game_offsets.size() < PositionIndex::MAX_GAME_OFFSETS) {
+      entry.game_offsets.push_back(record.offset);
+    }
+  }
+
+  IndexSummary finish() {
+    flush_entry();
+    flush_block();
+    string tail;
+    for (const auto &[key, block_offset] : directory) {
+      put_le(tail, key);
+      put_le(tail, block_offset);
+    }
+    put_le(tail, offset);
+    out << tail;
+
+    string header = "CHIX";
+    header += static_cast<char>(PositionIndex::VERSION);
+    header += string(3, '\0');
+    put_le(header, summary.entries);
+    put_le(header, directory.size());
+    put_le(header, offset);
+    out.seekp(0);
+    out << header;
+    out.close();
+    if (!out) {
+      throw "Can't write '" + path + "'.";
+    }
+    summary.blocks = directory.size();
+    summary.bytes = offset + tail.size();
+    return summary;
+  }
+};
+
+/** Reads back a run of sorted records written by build_position_index */
+class RunReader {
+  static constexpr size_t BUFFER_RECORDS = 1 << 15;
+
+  ifstream in;
+  vector<IndexRecord> buffer = vector<IndexRecord>(BUFFER_RECORDS);
+  size_t filled = 0;
+  size_t position = 0;
+
+ public:
+  explicit RunReader(const string &path) : in(path, ios::binary) {
+    if (!in) {
+      throw "Can't read '" + path + "'.";
+    }
+  }
+
+  bool next(IndexRecord &record) {
+    if (position == filled) {
+      in.read(
+          reinterpret_cast<char *>(buffer.data()), BUFFER_RECORDS * sizeof(IndexRecord)
+      );
+      filled = in.gcount() / sizeof(IndexRecord);
+      position = 0;
+      if (filled == 0) {
+        return false;
+      }
+    }
+    record = buffer[position++];
+    return true;
+  }
+};
+
+uint8_t parse_result(const string_view game) {
+  const size_t tag = game.find("[Result \"");
+  if (tag == string_view::npos) {
+    return 3;
+  }
+  const string_view result = game.substr(tag + 9);
+  return result.starts_with("1-0\"")       ? 0
+       : result.starts_with("1/2-1/2\"") ? 1
+       : result.starts_with("0-1\"")     ? 2
+                                         : 3;
+}
+
+IndexSummary build_position_index(
+    const string &pgn_path, const string &index_path, const size_t memory_megabytes
+) {
+  const MappedFile file(pgn_path);
+  file.advise_sequential();
+  PgnReader reader(file.view());
+  const size_t capacity =
+      max<size_t>(1, (memory_megabytes << 20) / sizeof(IndexRecord));
+  vector<IndexRecord> records;
+  vector<string> runs;
+  const auto write_run = [&] {
+    ranges::sort(records, by_position);
+    const string path = index_path + ".run" + to_string(runs.size());
+    ofstream run(path, ios::binary);
+    run.write(
+        reinterpret_cast<const char *>(records.data()),
+        records.size() * sizeof(IndexRecord)
+    );
+    if (!run) {
+      throw "Can't write '" + path + "'.";
+    }
+    runs.push_back(path);
+    records.clear();
+  };
+
+  size_t games = 0, invalid_games = 0, positions = 0;
+  while (const optional<string_view> game = reader.next_game()) {
+    const uint64_t offset = game->data() - file.view().data();
+    const uint8_t result = parse_result(*game);
+    try {
+      replay_pgn_game(*game, [&](const Game &position, const Move &move) {
+        records.push_back({position.hash, offset, move.data, result});
+        ++positions;
+      });
+    } catch (string) {
+      ++invalid_games;
+    }
+    ++games;
+    if (records.size() >= capacity) {
+      write_run();
+    }
+    file.release(reader.offset());
+  }
+
+  IndexWriter writer(index_path);
+  if (runs.empty()) {
+    ranges::sort(records, by_position);
+    for (const IndexRecord &record : records) {
+      writer.add(record);
+    }
+  } else {
+    if (!records.empty()) {
+      write_run();
+    }
+    vector<unique_ptr<RunReader>> readers;
+    using Head = pair<IndexRecord, size_t>;
+    const auto later = [](const Head &a, const Head &b) {
+      return by_position(b.first, a.first);
+    };
+    priority_queue<Head, vector<Head>, decltype(later)> heads(later);
+    for (size_t i = 0; i < runs.size(); ++i) {
+      readers.push_back(make_unique<RunReader>(runs[i]));
+      IndexRecord record;
+      if (readers[i]->next(record)) {
+        heads.emplace(record, i);
+      }
+    }
+    while (!heads.empty()) {
+      auto [record, run] = heads.top();
+      heads.pop();
+      writer.add(record);
+      if (readers[run]->next(record)) {
+        heads.emplace(record, run);
+      }
+    }
+    readers.clear();
+    for (const string &run : runs) {
+      remove(run.c_str());
+    }
+  }
+
+  IndexSummary summary = writer.finish();
+  summary.games = games;
+  summary.invalid_games = invalid_games;
+  summary.positions = positions;
+  return summary;
+}
+
+PositionIndex::PositionIndex(const string &path) : file(path) {
+  const string_view data = file.view();
+  const auto *bytes = reinterpret_cast<const uint8_t *>(data.data());
+  if (data.size() < HEADER_SIZE || data.substr(0, 4) != "CHIX" || bytes[4] != VERSION) {
+    throw path + " is not a position index.";
+  }
+  uint64_t directory_offset;
+  // the files are little-endian, as is every host this runs on
+  memcpy(&entry_count, bytes + 8, 8);
+  memcpy(&block_count, bytes + 16, 8);
+  memcpy(&directory_offset, bytes + 24, 8);
+  if (directory_offset > data.size()
+      || (data.size() - directory_offset) != block_count * 16 + 8) {
+    throw path + " has the wrong size.";
+  }
+  directory = bytes + directory_offset;
+  // lookups decode between these offsets and binary search the keys
+  uint64_t block_end = HEADER_SIZE;
+  for (size_t block = 0; block < block_count; ++block) {
+    const uint64_t block_offset = directory_value(2 * block + 1);
+    if (block_offset < block_end
+        || (block > 0 && directory_value(2 * block) < directory_value(2 * block - 2))) {
+      throw path + " has a corrupt block directory.";
+    }
+    block_end = block_offset;
+  }
+  if (directory_value(2 * block_count) != directory_offset
+      || block_end > directory_offset) {
+    throw path + " has a corrupt block directory.";
+  }
+}
+
+uint64_t PositionIndex::directory_value(const size_t index) const {
+  uint64_t value;
+  memcpy(&value, directory + 8 * index, 8);
+  return value;
+}
+
+vector<ExploredMove> PositionIndex::lookup(const Game &game) const {
+  const uint64_t key = game.hash;
+  // the last block starting at or before the key holds all its moves
+  size_t low = 0, high = block_count;
+  while (low < high) {
+    const size_t middle = (low + high) / 2;
+    if (directory_value(2 * middle) <= key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low == 0) {
+    return {};
+  }
+  const size_t block = low - 1;
+  const auto *start = reinterpret_cast<const uint8_t *>(file.view().data());
+  const uint8_t *data = start + directory_value(2 * block + 1);
+  const uint8_t *end = start
+                     + directory_value(
+                         block + 1 < block_count ? 2 * block + 3 : 2 * block_count
+                     );
+
+  vector<ExploredMove> moves;
+  const MoveList legal = generate_moves(game);
+  uint64_t entry_key = directory_value(2 * block);
+  for (uint64_t entries = get_varint(data, end); entries > 0; --entries) {
+    entry_key += get_varint(data, end);
+    if (entry_key > key) {
+      break;
+    }
+    ExploredMove entry;
+    entry.move.data = get_varint(data, end);
+    entry.games = get_varint(data, end);
+    entry.white_wins = get_varint(data, end);
+    entry.draws = get_varint(data, end);
+    entry.black_wins = get_varint(data, end);
+    const uint64_t offset_count = get_varint(data, end);
+    if (offset_count > PositionIndex::MAX_GAME_OFFSETS) {
+      throw string("The position index is corrupt.");
+    }
+    entry.game_offsets.resize(offset_count);
+    uint64_t offset = 0;
+    for (uint64_t &game_offset : entry.game_offsets) {
+      game_offset = offset += get_varint(data, end);
+    }
+    // a different position with the same key could have other moves
+    if (entry_key == key && ranges::find(legal, entry.move) != legal.end()) {
+      moves.push_back(std::move(entry));
+    }
+  }
+  ranges::stable_sort(moves, greater(), &ExploredMove::games);
+  return moves;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "board.h"
+#include "mapped_file.h"
+
+/** A move played from a position of the indexed games, and how they ended */
+struct ExploredMove {
+  Move move;
+  /** Games that played the move, each counted once */
+  uint32_t games;
+  uint32_t white_wins;
+  uint32_t draws;
+  uint32_t black_wins;
+  /** Byte offsets of the first games in the PGN file, at most MAX_GAME_OFFSETS */
+  std::vector<uint64_t> game_offsets;
+};
+
+/**
+ * Which moves were played from a position in a PGN corpus, with their
+ * results and the games they were played in, looked up by Zobrist key.
+ *
+ * File layout, all integers little-endian: a 32 byte header with "CHIX", a
+ * version, the number of entries and blocks and the offset of the block
+ * directory. Entries are sorted by key and move and grouped into blocks of
+ * about BLOCK_ENTRIES, never splitting the moves of one position. A block
+ * starts with its number of entries as a varint, then each entry holds the
+ * key as the difference to the previous one, the move, the game and result
+ * counts and the game offsets as differences, all as varints. The directory
+ * at the end holds the first key and the offset of every block, plus the
+ * offset where the last block ends.
+ *
+ * The file is mapped, so opening it only reads and checks the directory; a
+ * lookup binary searches the directory and decodes a single block.
+ */
+class PositionIndex {
+  MappedFile file;
+  uint64_t entry_count;
+  uint64_t block_count;
+  const uint8_t *directory;
+
+  uint64_t directory_value(size_t index) const;
+
+ public:
+  static constexpr size_t HEADER_SIZE = 32;
+  static constexpr uint8_t VERSION = 1;
+  static constexpr size_t BLOCK_ENTRIES = 128;
+  static constexpr size_t MAX_GAME_OFFSETS = 8;
+
+  /** Throws unless the header and block directory are consistent */
+  explicit PositionIndex(const std::string &path);
+
+  size_t size() const {
+    return entry_count;
+  }
+
+  /** Legal moves played from the position, most played first */
+  std::vector<ExploredMove> lookup(const Game &game) const;
+};
+
+/** Totals of a build_position_index run */
+struct IndexSummary {
+  size_t games;
+  size_t invalid_games;
+  size_t positions;
+  size_t entries;
+  size_t blocks;
+  size_t bytes;
+};
+
+/**
+ * Replay every game of a PGN file and write the index of all its positions.
+ * Positions are collected in sorted runs of at most memory_megabytes, which
+ * are written next to the index and merged when there is more than one, so
+ * corpora of any size can be indexed. Games with an illegal move contribute
+ * the positions before it.
+ */
+IndexSummary build_position_index(
+    const std::string &pgn_path, const std::string &index_path, size_t memory_megabytes
+);
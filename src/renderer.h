@@ -0,0 +1,217 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <utility>
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "board.h"
+
+/**
+ * Draws White's and Black's view of the board side by side. A frame is
+ * built in a fixed buffer and written with one flush, so drawing never
+ * allocates. The last move's squares are highlighted, and so is the King
+ * in check.
+ *
+ * On a terminal the boards are drawn once at the top of the screen and the
+ * text scrolls in the region below them. Later frames only redraw the
+ * squares that changed, addressed with the cursor. Other outputs, such as
+ * pipes, get every frame in full and in line with the text.
+ *
+ * The constructor takes the terminal's height for outputs other than the
+ * standard output; 0 asks the standard output for it, if it is a terminal.
+ */
+class BoardRenderer {
+  static constexpr uint8_t HEIGHT = 11;
+  static constexpr uint8_t WIDTH = 20;
+  static constexpr uint8_t GAP = 3;
+  /** Rows above a board's first rank, columns left of its first file */
+  static constexpr uint8_t TOP = 2;
+  static constexpr uint8_t LEFT = 2;
+
+  static constexpr std::string_view RESET = "\033[0m";
+  static constexpr std::string_view INVERT = "\033[7m";
+  static constexpr std::string_view LAST_MOVE = "\033[30;43m";
+  static constexpr std::string_view CHECK = "\033[30;41m";
+
+  enum Highlight : uint8_t { NONE, MOVED, CHECKED };
+  /** Piece code + 1 in the low bits, 0 for empty, and the highlight */
+  using Cell = uint8_t;
+  static constexpr Cell UNKNOWN = 0xff;
+
+  std::ostream &output;
+  /** Fixed terminal height, or 0 to ask the standard output */
+  const uint16_t fixed_rows;
+  /** Terminal rows when the boards were last drawn in full, 0 if never */
+  uint16_t screen_rows = 0;
+  std::array<Cell, 64> shown;
+  std::array<char, 8192> frame;
+  size_t length = 0;
+
+  void append(const std::string_view text) {
+    memcpy(frame.data() + length, text.data(), text.size());
+    length += text.size();
+  }
+
+  void append(uint16_t number) {
+    char digits[5];
+    size_t count = 0;
+    do {
+      digits[count++] = '0' + number % 10;
+      number /= 10;
+    } while (number);
+    while (count) {
+      frame[length++] = digits[--count];
+    }
+  }
+
+  void move_cursor(const uint16_t row, const uint16_t column) {
+    append("\033[");
+    append(row);
+    append(";");
+    append(column);
+    append("H");
+  }
+
+  static Cell cell(const Game &game, const uint8_t square) {
+    Cell cell = 0;
+    if (const std::optional<ColorPiece> piece = game.board.mailbox[square]) {
+      cell = piece->color * 6 + piece->piece + 1;
+    }
+    if (game.threats.checkers && game.board.of({game.turn, KING}) >> square & 1) {
+      cell |= CHECKED << 4;
+    } else if (!game.history.empty()
+               && (game.history.back().from().index() == square
+                   || game.history.back().to().index() == square)) {
+      cell |= MOVED << 4;
+    }
+    return cell;
+  }
+
+  /** Light squares and highlights have a light background, as shown */
+  void append_cell(const Cell cell, const uint8_t square) {
+    const bool light = ((square & 7) + (square >> 3)) % 2 == 0;
+    const Highlight highlight = static_cast<Highlight>(cell >> 4);
+    const bool dark_text = light || highlight != NONE;
+    append(highlight == CHECKED ? CHECK : highlight == MOVED ? LAST_MOVE : light ? INVERT : "");
+    if (cell & 0xf) {
+      const ColorPiece piece = {Color((cell & 0xf) - 1 >= 6), Piece(((cell & 0xf) - 1) % 6)};
+      append(UTF8_PIECES[piece.piece][dark_text ? invert(piece.color) : piece.color]);
+      append(" ");
+    } else {
+      append("  ");
+    }
+    if (dark_text) {
+      append(RESET);
+    }
+  }
+
+  /** Line of the frame, 0 at the top, and column of a square's cell */
+  static std::pair<uint8_t, uint8_t> position(const uint8_t square, const Color view) {
+    const uint8_t file = square & 7, rank = square >> 3;
+    if (view) {
+      return {TOP + 7 - rank, LEFT + 2 * file};
+    }
+    return {TOP + rank, WIDTH + GAP + LEFT + 2 * (7 - file)};
+  }
+
+  void append_full(const std::array<Cell, 64> &cells) {
+    for (uint8_t line = 0; line < HEIGHT; ++line) {
+      for (const Color view : {white, black}) {
+        if (line == 0) {
+          append(view ? "       WHITE        " : "       BLACK        ");
+        } else if (line == 1 || line == HEIGHT - 1) {
+          append(view ? "  a b c d e f g h   " : "  h g f e d c b a   ");
+        } else {
+          const uint8_t rank = view ? 7 - (line - TOP) : line - TOP;
+          const char label[] = {char('1' + rank), ' ', '\0'};
+          append(label);
+          for (uint8_t i = 0; i < 8; ++i) {
+            const uint8_t square = rank * 8 + (view ? i : 7 - i);
+            append_cell(cells[square], square);
+          }
+          append(" ");
+          append(std::string_view(label, 1));
+        }
+        append(view ? "   " : "\n");
+      }
+    }
+  }
+
+  void write() {
+    output.write(frame.data(), length);
+    output.flush();
+    length = 0;
+  }
+
+  uint16_t terminal_rows() const {
+    winsize size;
+    if (fixed_rows || !isatty(STDOUT_FILENO)) {
+      return fixed_rows;
+    }
+    return ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 ? size.ws_row : 0;
+  }
+
+ public:
+  explicit BoardRenderer(std::ostream &output = std::cout, const uint16_t rows = 0)
+      : output(output), fixed_rows(rows) {
+    shown.fill(UNKNOWN);
+  }
+
+  BoardRenderer(const BoardRenderer &) = delete;
+
+  ~BoardRenderer() {
+    if (screen_rows) {
+      // give the whole screen back to the text
+      append("\0337\033[r\0338\n");
+      write();
+    }
+  }
+
+  void draw(const Game &game) {
+    std::array<Cell, 64> cells;
+    for (uint8_t square = 0; square < 64; ++square) {
+      cells[square] = cell(game, square);
+    }
+    const uint16_t rows = terminal_rows();
+    if (rows <= HEIGHT + 2) {
+      append("\n");
+      append_full(cells);
+      append("\n");
+      write();
+      return;
+    }
+    if (rows != screen_rows) {
+      // clear the screen, draw everything and let the text scroll below
+      append("\033[r\033[2J\033[H");
+      append_full(cells);
+      append("\033[");
+      append(HEIGHT + 2);
+      append(";");
+      append(rows);
+      append("r");
+      move_cursor(HEIGHT + 2, 1);
+      screen_rows = rows;
+    } else {
+      append("\0337");
+      for (uint8_t square = 0; square < 64; ++square) {
+        if (cells[square] == shown[square]) {
+          continue;
+        }
+        for (const Color view : {white, black}) {
+          const auto [line, column] = position(square, view);
+          move_cursor(line + 1, column + 1);
+          append_cell(cells[square], square);
+        }
+      }
+      append("\0338");
+    }
+    shown = cells;
+    write();
+  }
+};
@@ -0,0 +1,588 @@
+#include "search.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+using namespace std;
+
+string format_score(const int16_t score) {
+  ostringstream result;
+  if (abs(score) > MATE_BOUND) {
+    const int moves = (MATE_SCORE - abs(score) + 1) / 2;
+    result << (score > 0 ? "#" : "-#") << moves;
+  } else {
+    result << (score < 0 ? "-" : "+") << abs(score) / 100 << '.'
+           << setw(2) << setfill('0') << abs(score) % 100;
+  }
+  return result.str();
+}
+
+/**
+ * What the threads of one search share. Besides the transposition table
+ * these are only atomics, everything else is owned by a single thread.
+ */
+struct SearchShared {
+  TranspositionTable &table;
+  const SearchLimits limits;
+  /** Exact scores of endings, may be null */
+  const Tablebases *tablebases;
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  atomic<bool> stopped = false;
+  /** Nodes of all threads, each adds its own in batches */
+  atomic<uint64_t> nodes = 0;
+};
+
+/**
+ * One thread of a principal variation search: the first move of every node
+ * is searched with the full window, the others with a null window around
+ * alpha that only gets widened if a move turns out to be better after all.
+ * Iterative deepening fills the transposition table and the history with
+ * the move ordering the next, deeper iteration relies on.
+ *
+ * Table entries pack move << 48 | score << 32 | depth << 8 | bound.
+ */
+class SearchThread {
+  enum Bound : uint8_t { UPPER = 1, LOWER = 2, EXACT = 3 };
+
+  SearchShared &shared;
+  const size_t index;
+  Game game;
+  /** Nodes not yet added to the shared count */
+  uint64_t nodes = 0;
+
+  struct ScoredMove {
+    int32_t score;
+    Move move;
+  };
+  using ScoredMoveList = InlineList<ScoredMove, MoveList::capacity()>;
+
+  enum class Stage : uint8_t {
+    TABLE_MOVE,
+    GOOD_CAPTURES,
+    KILLERS,
+    QUIETS,
+    BAD_CAPTURES,
+    DONE
+  };
+
+  /**
+   * Where one ply is in handing out its moves. The lists are stored inline
+   * and only filled once a stage needs them, so a node that is cut off by
+   * its table move or a capture never generates its quiet moves.
+   */
+  struct MovePicker {
+    Stage stage;
+    Move table_move;
+    array<Move, 2> killers;
+    /** Quiescence leaves out the quiet moves and the losing captures */
+    bool captures_only;
+    bool captures_generated;
+    bool quiets_generated;
+    uint8_t next_killer;
+    size_t next_capture;
+    size_t next_quiet;
+    size_t next_bad_capture;
+    /** Captures and queen promotions by victim and attacker */
+    ScoredMoveList captures;
+    /** Quiet moves by history */
+    ScoredMoveList quiets;
+    /** Captures that lose material by static exchange and under-promotions */
+    MoveList bad_captures;
+  };
+
+  array<MovePicker, MAX_PLY> pickers;
+  MoveList generated;
+  array<array<Move, 2>, MAX_PLY> killers = {};
+  /** Bonus of quiet moves that caused a cutoff, by color, from and to */
+  array<array<array<int32_t, 64>, 64>, 2> history = {};
+  /** Triangular table: the variation found below each ply */
+  array<array<Move, MAX_PLY>, MAX_PLY> pv = {};
+  array<uint8_t, MAX_PLY> pv_length = {};
+
+  bool out_of_budget() {
+    ++nodes;
+    const SearchLimits &limits = shared.limits;
+    if (limits.nodes
+        && shared.nodes.load(memory_order_relaxed) + nodes >= *limits.nodes) {
+      shared.stopped = true;
+    }
+    if (limits.stop && limits.stop->load(memory_order_relaxed)) {
+      shared.stopped = true;
+    }
+    if ((nodes & 1023) == 0) {
+      shared.nodes += exchange(nodes, 0);
+      if (limits.movetime
+          && chrono::steady_clock::now() - shared.start >= *limits.movetime) {
+        shared.stopped = true;
+      }
+    }
+    return shared.stopped.load(memory_order_relaxed);
+  }
+
+  /**
+   * Only positions since the last capture or pawn move can repeat, and the
+   * fifty-move rule draws anything older than 100 plies anyway.
+   */
+  bool is_repetition() const {
+    const vector<uint64_t> &previous = game.previous_hashes;
+    const size_t plies = min<size_t>({game.halfmove_clock, 100, previous.size()});
+    const size_t oldest = previous.size() - plies;
+    for (size_t i = previous.size(); i >= oldest + 2; i -= 2) {
+      if (previous[i - 2] == game.hash) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool is_capture(const Move &move) const {
+    return game.board.mailbox[move.to().index()]
+        || move.flag() == Move::EN_PASSANT;
+  }
+
+  Piece victim(const Move &move) const {
+    return move.flag() == Move::EN_PASSANT
+             ? PAWN
+             : game.board.mailbox[move.to().index()]
+                   .value_or(ColorPiece{white, KING})
+                   .piece;
+  }
+
+  /**
+   * A capture can only lose material if the attacker is worth more than
+   * the victim, only then is the static exchange worth evaluating.
+   */
+  bool loses_material(const Move &move) const {
+    const Piece attacker = game.board.mailbox[move.from().index()]->piece;
+    return PIECE_VALUES[attacker] > PIECE_VALUES[victim(move)]
+        && static_exchange(game, move) < 0;
+  }
+
+  void generate_captures(MovePicker &picker) {
+    if (exchange(picker.captures_generated, true)) {
+      return;
+    }
+    generate_moves(game, generated, MoveSelection::CAPTURES);
+    for (const Move &move : generated) {
+      const optional<Piece> promotion = move.promotion();
+      if (promotion && *promotion != QUEEN) {
+        if (!picker.captures_only) {
+          picker.bad_captures.push_back(move);
+        }
+        continue;
+      }
+      const Piece attacker = game.board.mailbox[move.from().index()]->piece;
+      picker.captures.push_back(
+          {PIECE_VALUES[victim(move)] * 8 - attacker
+               + (promotion ? PIECE_VALUES[QUEEN] : 0),
+           move}
+      );
+    }
+  }
+
+  void generate_quiets(MovePicker &picker) {
+    if (exchange(picker.quiets_generated, true)) {
+      return;
+    }
+    generate_moves(game, generated, MoveSelection::QUIETS);
+    for (const Move &move : generated) {
+      picker.quiets.push_back(
+          {history[game.turn][move.from().index()][move.to().index()], move}
+      );
+    }
+  }
+
+  void start_moves(const uint8_t ply, const Move &table_move, const bool captures_only) {
+    MovePicker &picker = pickers[ply];
+    picker.stage = Stage::TABLE_MOVE;
+    picker.table_move = table_move;
+    picker.killers = killers[ply];
+    picker.captures_only = captures_only;
+    picker.captures_generated = picker.quiets_generated = false;
+    picker.next_killer = 0;
+    picker.next_capture = picker.next_quiet = picker.next_bad_capture = 0;
+    picker.captures.clear();
+    picker.quiets.clear();
+    picker.bad_captures.clear();
+  }
+
+  /**
+   * The next move of this ply, or an empty move once all are handed out:
+   * the table's best move first, then the captures of the most valuable
+   * victim by the least valuable attacker that don't lose material, the
+   * killers, the other quiet moves by history and last the losing captures.
+   */
+  Move next_move(const uint8_t ply) {
+    MovePicker &picker = pickers[ply];
+    switch (picker.stage) {
+      case Stage::TABLE_MOVE:
+        picker.stage = Stage::GOOD_CAPTURES;
+        if (picker.table_move.data && is_legal(game, picker.table_move)) {
+          return picker.table_move;
+        }
+        [[fallthrough]];
+      case Stage::GOOD_CAPTURES:
+        generate_captures(picker);
+        while (picker.next_capture < picker.captures.size()) {
+          const Move move = pick(picker.captures, picker.next_capture++);
+          if (move == picker.table_move) {
+            continue;
+          }
+          if (loses_material(move)) {
+            if (!picker.captures_only) {
+              picker.bad_captures.push_back(move);
+            }
+            continue;
+          }
+          return move;
+        }
+        picker.stage = picker.captures_only ? Stage::DONE : Stage::KILLERS;
+        if (picker.captures_only) {
+          return Move();
+        }
+        [[fallthrough]];
+      case Stage::KILLERS:
+        while (picker.next_killer < picker.killers.size()) {
+          const Move move = picker.killers[picker.next_killer++];
+          if (move.data && move != picker.table_move && !is_capture(move)
+              && !move.promotion() && is_legal(game, move)) {
+            return move;
+          }
+        }
+        picker.stage = Stage::QUIETS;
+        [[fallthrough]];
+      case Stage::QUIETS:
+        generate_quiets(picker);
+        while (picker.next_quiet < picker.quiets.size()) {
+          const Move move = pick(picker.quiets, picker.next_quiet++);
+          if (move != picker.table_move && move != picker.killers[0]
+              && move != picker.killers[1]) {
+            return move;
+          }
+        }
+        picker.stage = Stage::BAD_CAPTURES;
+        [[fallthrough]];
+      case Stage::BAD_CAPTURES:
+        while (picker.next_bad_capture < picker.bad_captures.size()) {
+          const Move move = picker.bad_captures[picker.next_bad_capture++];
+          if (move != picker.table_move) {
+            return move;
+          }
+        }
+        picker.stage = Stage::DONE;
+        [[fallthrough]];
+      case Stage::DONE:
+        break;
+    }
+    return Move();
+  }
+
+  /** Bring the best remaining move to position i, cheaper than sorting all */
+  static Move pick(ScoredMoveList &moves, const size_t i) {
+    size_t best = i;
+    for (size_t j = i + 1; j < moves.size(); ++j) {
+      if (moves[j].score > moves[best].score) {
+        best = j;
+      }
+    }
+    swap(moves[i], moves[best]);
+    return moves[i].move;
+  }
+
+  void update_pv(const uint8_t ply, const Move &move) {
+    pv[ply][ply] = move;
+    for (uint8_t i = ply + 1; i < pv_length[ply + 1]; ++i) {
+      pv[ply][i] = pv[ply + 1][i];
+    }
+    pv_length[ply] = max(pv_length[ply + 1], uint8(ply + 1));
+  }
+
+  /**
+   * Resolve captures until the position is quiet, so the static evaluation
+   * isn't taken in the middle of an exchange. The side to move may always
+   * stand pat instead, unless it is in check.
+   */
+  int16_t quiescence(int16_t alpha, const int16_t beta, const uint8_t ply) {
+    pv_length[ply] = ply;
+    if (out_of_budget()) {
+      return 0;
+    }
+    const bool in_check = game.threats.checkers;
+    if (!in_check) {
+      const int16_t stand_pat = evaluate(game);
+      if (stand_pat >= beta || ply >= MAX_PLY - 1) {
+        return stand_pat;
+      }
+      alpha = max(alpha, stand_pat);
+    }
+
+    // out of check only captures that don't lose material are worth a look
+    start_moves(ply, Move(), !in_check);
+    Move move = next_move(ply);
+    if (!move.data) {
+      return in_check ? -MATE_SCORE + ply : alpha;
+    }
+    if (ply >= MAX_PLY - 1) {
+      return evaluate(game);
+    }
+    int16_t best = in_check ? -INFINITE_SCORE : alpha;
+    for (; move.data; move = next_move(ply)) {
+      const Undo undo = apply_move(game, move);
+      const int16_t score = -quiescence(-beta, -alpha, ply + 1);
+      undo_move(game, move, undo);
+      if (shared.stopped.load(memory_order_relaxed)) {
+        return 0;
+      }
+      if (score > best) {
+        best = score;
+        if (score > alpha) {
+          alpha = score;
+          update_pv(ply, move);
+          if (alpha >= beta) {
+            break;
+          }
+        }
+      }
+    }
+    return best;
+  }
+
+  int16_t negamax(int16_t alpha, const int16_t beta, int depth, const uint8_t ply) {
+    pv_length[ply] = ply;
+    if (ply > 0 && is_repetition()) {
+      return 0;
+    }
+    if (ply > 0 && shared.tablebases
+        && popcount(game.board.occupied) <= 2 + TABLEBASE_MAX_PIECES) {
+      if (const optional<TablebaseResult> result = shared.tablebases->probe(game)) {
+        const int16_t mate = MATE_SCORE - ply - result->plies;
+        return result->wdl == Wdl::WIN ? mate : result->wdl == Wdl::LOSS ? -mate : 0;
+      }
+    }
+    const bool in_check = game.threats.checkers;
+    if (in_check) {
+      ++depth;  // never stop searching while in check
+    }
+    if (depth <= 0 || ply >= MAX_PLY - 1) {
+      return quiescence(alpha, beta, ply);
+    }
+    if (out_of_budget()) {
+      return 0;
+    }
+
+    Move table_move;
+    if (const optional<uint64_t> entry = shared.table.probe(game.hash)) {
+      table_move.data = *entry >> 48;
+      int16_t score = static_cast<int16_t>(*entry >> 32);
+      score += score > MATE_BOUND ? -ply : score < -MATE_BOUND ? ply : 0;
+      const Bound bound = static_cast<Bound>(*entry & 0b11);
+      const bool is_pv = beta - alpha > 1;
+      if (ply > 0 && !is_pv && (*entry >> 8 & 0xff) >= uint8_t(depth)
+          && (bound == EXACT || (bound == LOWER && score >= beta)
+              || (bound == UPPER && score <= alpha))) {
+        return score;
+      }
+    }
+
+    start_moves(ply, table_move, false);
+    Move move = next_move(ply);
+    if (!move.data) {
+      return in_check ? -MATE_SCORE + ply : 0;
+    }
+    int16_t best = -INFINITE_SCORE;
+    Move best_move = move;
+    Bound bound = UPPER;
+    const vector<Move> &root_moves = shared.limits.root_moves;
+    for (bool first = true; move.data; move = next_move(ply)) {
+      if (ply == 0 && !root_moves.empty()
+          && ranges::find(root_moves, move) == root_moves.end()) {
+        continue;
+      }
+      const bool quiet = !is_capture(move) && !move.promotion();
+      const Undo undo = apply_move(game, move);
+      int16_t score;
+      if (exchange(first, false)) {
+        score = -negamax(-beta, -alpha, depth - 1, ply + 1);
+      } else {
+        score = -negamax(-alpha - 1, -alpha, depth - 1, ply + 1);
+        if (score > alpha && score < beta) {
+          score = -negamax(-beta, -alpha, depth - 1, ply + 1);
+        }
+      }
+      undo_move(game, move, undo);
+      if (shared.stopped.load(memory_order_relaxed)) {
+        return 0;
+      }
+      if (score > best) {
+        best = score;
+        best_move = move;
+        if (score > alpha) {
+          alpha = score;
+          bound = EXACT;
+          update_pv(ply, move);
+          if (alpha >= beta) {
+            bound = LOWER;
+            if (quiet) {
+              if (!(killers[ply][0] == move)) {
+                killers[ply][1] = killers[ply][0];
+                killers[ply][0] = move;
+              }
+              int32_t &bonus =
+                  history[game.turn][move.from().index()][move.to().index()];
+              bonus = min(bonus + depth * depth, 1 << 26);
+            }
+            break;
+          }
+        }
+      }
+    }
+
+    const int16_t stored =
+        best + (best > MATE_BOUND ? ply : best < -MATE_BOUND ? -ply : 0);
+    shared.table.store(
+        game.hash,
+        uint64_t(best_move.data) << 48 | uint64_t(uint16_t(stored)) << 32
+            | uint64_t(depth) << 8 | bound
+    );
+    return best;
+  }
+
+  /**
+   * Helper threads skip some depths in a pattern that depends on their
+   * index, so at any time they are spread over the current and the next few
+   * depths instead of all repeating the main thread's work.
+   */
+  bool skips(const uint8_t depth) const {
+    static constexpr array<uint8_t, 20> SKIP_SIZE = {
+        1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+    static constexpr array<uint8_t, 20> SKIP_PHASE = {
+        0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+    if (index == 0) {
+      return false;
+    }
+    const size_t i = (index - 1) % SKIP_SIZE.size();
+    return (depth + SKIP_PHASE[i]) / SKIP_SIZE[i] % 2;
+  }
+
+ public:
+  /** Result of this thread's deepest completed iteration */
+  SearchReport result = {};
+
+  SearchThread(SearchShared &shared, const size_t index, const Game &game)
+      : shared(shared), index(index), game(game) {}
+
+  /**
+   * Deepen the search one ply at a time until it is stopped. From depth 4
+   * on, each iteration starts with a narrow window around the previous score
+   * and only widens it when the score falls outside.
+   */
+  void run(const function<void(const SearchReport &)> &report) {
+    const SearchLimits &limits = shared.limits;
+    int16_t score = 0;
+    for (uint8_t depth = 1; depth <= limits.depth && depth < MAX_PLY; ++depth) {
+      if (skips(depth)) {
+        continue;
+      }
+      int16_t delta = depth >= 4 ? 25 : INFINITE_SCORE;
+      int16_t alpha = max<int>(-INFINITE_SCORE, score - delta);
+      int16_t beta = min<int>(INFINITE_SCORE, score + delta);
+      while (true) {
+        const int16_t value = negamax(alpha, beta, depth, 0);
+        if (shared.stopped) {
+          break;
+        }
+        delta = min<int>(INFINITE_SCORE, 2 * delta);
+        if (value <= alpha) {
+          alpha = max<int>(-INFINITE_SCORE, value - delta);
+        } else if (value >= beta) {
+          beta = min<int>(INFINITE_SCORE, value + delta);
+        } else {
+          score = value;
+          break;
+        }
+      }
+      if (shared.stopped) {
+        break;
+      }
+      const chrono::duration<double> elapsed =
+          chrono::steady_clock::now() - shared.start;
+      result = {
+          depth,
+          score,
+          shared.nodes + nodes,
+          elapsed,
+          {pv[0].begin(), pv[0].begin() + pv_length[0]}};
+      if (index > 0) {
+        continue;
+      }
+      report(result);
+      // an iteration takes several times longer than the one before
+      if (abs(score) > MATE_BOUND
+          || (limits.movetime && elapsed > *limits.movetime / 2)) {
+        break;
+      }
+    }
+    shared.nodes += exchange(nodes, 0);
+    // helpers only search for as long as the main thread does
+    if (index == 0) {
+      shared.stopped = true;
+    }
+  }
+};
+
+SearchReport parallel_search(
+    const Game &game,
+    TranspositionTable &table,
+    const SearchLimits &limits,
+    const size_t threads,
+    const Tablebases *tablebases,
+    const function<void(const SearchReport &)> &report
+) {
+  SearchShared shared = {table, limits, tablebases};
+  vector<unique_ptr<SearchThread>> searchers;
+  for (size_t i = 0; i < threads; ++i) {
+    searchers.push_back(make_unique<SearchThread>(shared, i, game));
+  }
+  vector<thread> helpers;
+  for (size_t i = 1; i < threads; ++i) {
+    helpers.emplace_back(&SearchThread::run, searchers[i].get(), report);
+  }
+  searchers[0]->run(report);
+  for (thread &helper : helpers) {
+    helper.join();
+  }
+
+  SearchReport best = searchers[0]->result;
+  for (const unique_ptr<SearchThread> &searcher : searchers) {
+    if (searcher->result.depth > best.depth) {
+      best = searcher->result;
+    }
+  }
+  best.nodes = shared.nodes;
+  best.elapsed = chrono::steady_clock::now() - shared.start;
+  if (best.pv.empty()) {
+    // out of budget before depth 1 was done, any legal move is better than none
+    if (!limits.root_moves.empty()) {
+      best.pv = {limits.root_moves.front()};
+    } else {
+      const MoveList moves = generate_moves(game);
+      best.pv.assign(moves.begin(), moves.begin() + min<size_t>(1, moves.size()));
+    }
+  }
+  return best;
+}
+
+string format_pv(const Game &game, const vector<Move> &pv) {
+  Game line = game;
+  string result;
+  for (const Move &move : pv) {
+    result += ' ';
+    result += encode_move(line, move);
+    apply_move(line, move);
+  }
+  return result;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "board.h"
+#include "evaluation.h"
+#include "tablebase.h"
+#include "transposition_table.h"
+
+/** A search ends at whichever of its limits is reached first. */
+struct SearchLimits {
+  uint8_t depth = MAX_PLY - 1;
+  std::optional<std::chrono::milliseconds> movetime = std::nullopt;
+  std::optional<uint64_t> nodes = std::nullopt;
+  /** Set from another thread to end the search, e.g. by the UCI 'stop' */
+  const std::atomic<bool> *stop = nullptr;
+  /** Only these moves are searched at the root, all legal moves if empty */
+  std::vector<Move> root_moves = {};
+};
+
+/** Outcome of one completed iteration of the search */
+struct SearchReport {
+  uint8_t depth;
+  int16_t score;
+  uint64_t nodes;
+  std::chrono::duration<double> elapsed;
+  std::vector<Move> pv;
+};
+
+/** Score as shown to the user, e.g. "+0.35", "-1.20" or "#3" */
+std::string format_score(int16_t score);
+
+/**
+ * Lazy SMP: all threads search the same root on their own copy of the game
+ * and only communicate through the transposition table, where the helpers
+ * leave results that let the main thread skip parts of its tree. The main
+ * thread reports each of its iterations and stops the helpers when done.
+ *
+ * Returns the deepest completed iteration of any thread with the nodes of
+ * all threads. Its PV is empty if not even depth 1 could be completed.
+ */
+SearchReport parallel_search(
+    const Game &game,
+    TranspositionTable &table,
+    const SearchLimits &limits,
+    size_t threads,
+    const Tablebases *tablebases,
+    const std::function<void(const SearchReport &)> &report
+);
+
+/** Principal variation in SAN, starting with a space */
+std::string format_pv(const Game &game, const std::vector<Move> &pv);
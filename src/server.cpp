@@ -0,0 +1,410 @@
+#include "server.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "board.h"
+
+using namespace std;
+
+/** Longer lines are not commands, the connection is closed */
+constexpr size_t MAX_LINE = 4096;
+/** Stop reading from a client that doesn't read its replies */
+constexpr size_t MAX_PENDING_OUTPUT = 1 << 20;
+constexpr size_t READ_SIZE = 1 << 16;
+
+/** Becomes readable when the server should stop, for every shard at once */
+int stop_event = -1;
+
+void request_stop(int) {
+  const uint64_t one = 1;
+  // nothing to do if it fails, the counter can only overflow
+  [[maybe_unused]] const auto written = write(stop_event, &one, sizeof(one));
+}
+
+struct ServedGame {
+  Game game;
+  string_view result = "*";
+};
+
+struct Connection {
+  int fd;
+  /** Events registered with epoll */
+  uint32_t events = EPOLLIN;
+  string input = "";
+  string output = "";
+  /** Bytes at the front of output that were already sent */
+  size_t sent = 0;
+  unordered_map<uint32_t, ServedGame> games = {};
+  uint32_t next_id = 1;
+};
+
+struct ShardStats {
+  uint64_t connections = 0;
+  uint64_t games = 0;
+  uint64_t commands = 0;
+  uint64_t moves = 0;
+  uint64_t errors = 0;
+};
+
+/**
+ * The PGN result after a move: mate or a draw by stalemate, repetition, the
+ * fifty-move rule or insufficient material, otherwise "*"
+ */
+string_view game_result(const Game &game) {
+  if (!has_legal_moves(game)) {
+    return game.threats.checkers ? (game.turn ? "0-1" : "1-0") : "1/2-1/2";
+  }
+  if (game.halfmove_clock >= 100 || is_threefold_repetition(game)
+      || is_insufficient_material(game.board)) {
+    return "1/2-1/2";
+  }
+  return "*";
+}
+
+class ServerShard {
+  int epoll;
+  int listener;
+  unordered_map<int, unique_ptr<Connection>> connections;
+
+  using GameEntry = unordered_map<uint32_t, ServedGame>::iterator;
+
+  GameEntry find_game(Connection &connection, const string_view id) {
+    uint32_t number = 0;
+    const auto [end, error] = from_chars(id.data(), id.data() + id.size(), number);
+    const auto game = connection.games.find(number);
+    if (error != errc() || end != id.data() + id.size()
+        || game == connection.games.end()) {
+      throw "no game " + string(id);
+    }
+    return game;
+  }
+
+  string play(ServedGame &served, const string_view san) {
+    if (served.result != "*") {
+      throw string("the game is over");
+    }
+    Game &game = served.game;
+    const Move move = decode_move(game, san);
+    // clients are untrusted, so only play what the move generator agrees to
+    const MoveList legal = generate_moves(game);
+    if (ranges::find(legal, move) == legal.end()) {
+      throw string("illegal move");
+    }
+    const string normalised = encode_move(game, move);
+    apply_move(game, move);
+    served.result = game_result(game);
+    ++stats.moves;
+    return normalised + " " + string(served.result);
+  }
+
+  /** The reply to one command line, without "ok " */
+  string execute(Connection &connection, const string_view line) {
+    const size_t space = line.find(' ');
+    const string_view command = line.substr(0, space);
+    const string_view arguments =
+        space == string_view::npos ? string_view() : line.substr(space + 1);
+    const size_t id_end = arguments.find(' ');
+    const string_view id = arguments.substr(0, id_end);
+
+    if (command == "new") {
+      if (connection.games.size() >= MAX_GAMES_PER_CONNECTION) {
+        throw "too many games, at most " + to_string(MAX_GAMES_PER_CONNECTION)
+            + " per connection";
+      }
+      ServedGame served;
+      if (!arguments.empty()) {
+        served.game = parse_fen(string(arguments));
+        served.result = game_result(served.game);
+      }
+      const uint32_t number = connection.next_id++;
+      connection.games.emplace(number, std::move(served));
+      ++stats.games;
+      return to_string(number);
+    }
+    if (command == "move") {
+      if (id_end == string_view::npos) {
+        throw string("usage: move <id> <SAN>");
+      }
+      return play(find_game(connection, id)->second, arguments.substr(id_end + 1));
+    }
+    if (command == "fen") {
+      return to_fen(find_game(connection, id)->second.game);
+    }
+    if (command == "history") {
+      const Game &game = find_game(connection, id)->second.game;
+      Game replay = game.starting_fen.empty() ? Game() : parse_fen(game.starting_fen);
+      string moves = "";
+      for (const Move &move : game.history) {
+        moves += moves.empty() ? "" : " ";
+        moves += encode_move(replay, move);
+        apply_move(replay, move);
+      }
+      return moves;
+    }
+    if (command == "resign") {
+      const GameEntry entry = find_game(connection, id);
+      const ServedGame &served = entry->second;
+      const string result(
+          served.result != "*" ? served.result : served.game.turn ? "0-1" : "1-0"
+      );
+      connection.games.erase(entry);
+      return result;
+    }
+    throw "unknown command '" + string(command) + "'";
+  }
+
+  void update_events(Connection &connection) {
+    const bool pending = connection.sent < connection.output.size();
+    const uint32_t events =
+        (pending ? uint32_t(EPOLLOUT) : 0)
+        | (connection.output.size() < MAX_PENDING_OUTPUT ? uint32_t(EPOLLIN) : 0);
+    if (events != connection.events) {
+      epoll_event event = {.events = events, .data = {.fd = connection.fd}};
+      epoll_ctl(epoll, EPOLL_CTL_MOD, connection.fd, &event);
+      connection.events = events;
+    }
+  }
+
+  /** Send as much output as the socket takes, false if the client is gone */
+  bool flush(Connection &connection) {
+    while (connection.sent < connection.output.size()) {
+      const ssize_t sent = send(
+          connection.fd, connection.output.data() + connection.sent,
+          connection.output.size() - connection.sent, MSG_NOSIGNAL | MSG_DONTWAIT
+      );
+      if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+        return errno == EINTR ? flush(connection) : false;
+      }
+      connection.sent += sent;
+    }
+    if (connection.sent == connection.output.size()) {
+      connection.output.clear();
+      connection.sent = 0;
+    }
+    return true;
+  }
+
+  /** Read what arrived and answer every complete line, false to disconnect */
+  bool receive(Connection &connection) {
+    const size_t old_size = connection.input.size();
+    connection.input.resize(old_size + READ_SIZE);
+    const ssize_t received =
+        recv(connection.fd, connection.input.data() + old_size, READ_SIZE, 0);
+    connection.input.resize(old_size + max<ssize_t>(received, 0));
+    if (received == 0) {
+      return false;
+    }
+    if (received < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+
+    size_t start = 0;
+    for (size_t end; (end = connection.input.find('\n', start)) != string::npos;
+         start = end + 1) {
+      string_view line(connection.input.data() + start, end - start);
+      if (line.ends_with('\r')) {
+        line.remove_suffix(1);
+      }
+      if (line.empty()) {
+        continue;
+      }
+      ++stats.commands;
+      try {
+        const string reply = execute(connection, line);
+        connection.output += reply.empty() ? "ok" : "ok " + reply;
+      } catch (string err) {
+        ++stats.errors;
+        connection.output += "error " + err;
+      }
+      connection.output += '\n';
+    }
+    connection.input.erase(0, start);
+    return connection.input.size() <= MAX_LINE;
+  }
+
+  void accept_connection() {
+    const int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      // another shard was quicker, or the client gave up
+      return;
+    }
+    auto connection = make_unique<Connection>(Connection{.fd = fd});
+    epoll_event event = {.events = connection->events, .data = {.fd = fd}};
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+      close(fd);
+      return;
+    }
+    connections.emplace(fd, std::move(connection));
+    ++stats.connections;
+  }
+
+  void disconnect(const int fd) {
+    epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+  }
+
+ public:
+  ShardStats stats;
+
+  explicit ServerShard(const int listener)
+      : epoll(epoll_create1(EPOLL_CLOEXEC)), listener(listener) {
+    if (epoll < 0) {
+      throw string("Can't create an epoll instance: ") + strerror(errno);
+    }
+    // only one shard wakes up per new connection
+    epoll_event event = {.events = EPOLLIN | EPOLLEXCLUSIVE, .data = {.fd = listener}};
+    epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+    event = {.events = EPOLLIN, .data = {.fd = stop_event}};
+    epoll_ctl(epoll, EPOLL_CTL_ADD, stop_event, &event);
+  }
+
+  ServerShard(const ServerShard &) = delete;
+  ServerShard &operator=(const ServerShard &) = delete;
+
+  ~ServerShard() {
+    for (const auto &[fd, connection] : connections) {
+      close(fd);
+    }
+    close(epoll);
+  }
+
+  void run() {
+    array<epoll_event, 256> events;
+    while (true) {
+      const int count = epoll_wait(epoll, events.data(), events.size(), -1);
+      if (count < 0 && errno != EINTR) {
+        cerr << "epoll_wait: " << strerror(errno) << endl;
+        return;
+      }
+      for (int i = 0; i < count; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == stop_event) {
+          return;
+        }
+        if (fd == listener) {
+          accept_connection();
+          continue;
+        }
+        const auto found = connections.find(fd);
+        if (found == connections.end()) {
+          continue;
+        }
+        Connection &connection = *found->second;
+        bool open = !(events[i].events & (EPOLLERR | EPOLLHUP))
+                 || events[i].events & EPOLLIN;
+        if (open && events[i].events & EPOLLIN) {
+          open = receive(connection);
+        }
+        if (open) {
+          open = flush(connection);
+        }
+        if (open) {
+          update_events(connection);
+        } else {
+          disconnect(fd);
+        }
+      }
+    }
+  }
+};
+
+int listen_on(const string &path) {
+  sockaddr_un address = {.sun_family = AF_UNIX, .sun_path = {}};
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw "The socket path '" + path + "' is too long.";
+  }
+  ranges::copy(path, address.sun_path);
+
+  // a socket left behind by a server that is gone; other files stay
+  struct stat info;
+  if (stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+    const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const bool in_use =
+        connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+    close(probe);
+    if (in_use) {
+      throw "A server is already listening on '" + path + "'.";
+    }
+    unlink(path.c_str());
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0
+      || listen(fd, SOMAXCONN) < 0) {
+    const string reason = strerror(errno);
+    if (fd >= 0) {
+      close(fd);
+    }
+    throw "Can't listen on '" + path + "': " + reason;
+  }
+  return fd;
+}
+
+void serve(const string &socket_path, const size_t shards) {
+  const int listener = listen_on(socket_path);
+  stop_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  signal(SIGINT, request_stop);
+  signal(SIGTERM, request_stop);
+
+  const auto start = chrono::steady_clock::now();
+  vector<unique_ptr<ServerShard>> servers;
+  for (size_t i = 0; i < shards; ++i) {
+    servers.push_back(make_unique<ServerShard>(listener));
+  }
+  cout << "Serving games on " << socket_path << " with " << shards
+       << (shards == 1 ? " shard" : " shards") << ", stop with Ctrl+C." << endl;
+  vector<thread> threads;
+  for (const auto &server : servers) {
+    threads.emplace_back([&server] { server->run(); });
+  }
+  for (thread &thread : threads) {
+    thread.join();
+  }
+  const chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+
+  close(listener);
+  unlink(socket_path.c_str());
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+
+  cout << endl;
+  ShardStats total;
+  for (size_t i = 0; i < servers.size(); ++i) {
+    const ShardStats &stats = servers[i]->stats;
+    cout << "Shard " << i << ": " << stats.connections << " connections, "
+         << stats.games << " games, " << stats.moves << " moves, "
+         << stats.commands << " commands (" << stats.errors << " errors)" << endl;
+    total.moves += stats.moves;
+    total.commands += stats.commands;
+  }
+  servers.clear();
+  close(stop_event);
+  cout << "Time: " << seconds.count() << " s (" << fixed << setprecision(0)
+       << total.commands / seconds.count() << " commands/s, "
+       << total.moves / seconds.count() << " moves/s)" << defaultfloat << endl;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Host many games at once over a Unix domain socket, for clients that play
+ * casual games without a terminal each. Every shard is one thread with its
+ * own epoll loop; a new connection is accepted by whichever shard wakes up
+ * first and stays there, so shards share nothing and take no locks.
+ *
+ * The protocol has one command per line and one reply line per command,
+ * sent in order, so clients may pipeline:
+ *
+ *   new [<FEN>]       ok <id>
+ *   move <id> <SAN>   ok <SAN> <result>
+ *   fen <id>          ok <FEN>
+ *   history <id>      ok <SAN> <SAN> …
+ *   resign <id>       ok <result>
+ *
+ * The result is "*" while the game goes on, otherwise "1-0", "0-1" or
+ * "1/2-1/2" as in PGN; draws by stalemate, threefold repetition, the
+ * fifty-move rule and insufficient material end the game at once. Moves must
+ * be among the legal moves of the position and the reply has them in
+ * normalised SAN, e.g. "Nf3" or "Qxf7#". Games belong to the connection that
+ * started them; resigning, which also closes a finished game, or
+ * disconnecting frees them. A connection can have at most 1024 games open.
+ * Failed commands get "error <reason>".
+ */
+
+/** Games one connection may have open, so no client can use up the memory */
+constexpr size_t MAX_GAMES_PER_CONNECTION = 1024;
+
+/** Serve until SIGINT or SIGTERM, then print the totals of each shard */
+void serve(const std::string &socket_path, size_t shards);
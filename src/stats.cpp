@@ -0,0 +1,71 @@
+#include "stats.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <sstream>
+
+using namespace std;
+
+array<StatCounter, STAT_COUNT> stat_counters;
+
+#ifdef CHESS_STATS
+// Replacing the global allocation functions counts every allocation of the
+// program, including those inside the standard library.
+void *operator new(const size_t size) {
+  count_stat(HEAP_ALLOCATIONS);
+  if (void *pointer = malloc(max<size_t>(size, 1))) {
+    return pointer;
+  }
+  throw bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+  free(pointer);
+}
+#endif
+
+double per_move(const uint64_t calls) {
+  const uint64_t moves = stat_counters[MOVES_APPLIED].calls.load(memory_order_relaxed);
+  return moves ? double(calls) / moves : 0;
+}
+
+string stats_report() {
+  ostringstream report;
+  report << left << setw(30) << "statistic" << right << setw(14) << "calls"
+         << setw(12) << "per move" << setw(12) << "total ms" << setw(10)
+         << "ns/call" << "\n";
+  for (uint8_t stat = 0; stat < STAT_COUNT; ++stat) {
+    const uint64_t calls = stat_counters[stat].calls.load(memory_order_relaxed);
+    const uint64_t nanoseconds =
+        stat_counters[stat].nanoseconds.load(memory_order_relaxed);
+    report << left << setw(30) << STAT_NAMES[stat] << right << setw(14) << calls
+           << setw(12) << fixed << setprecision(2) << per_move(calls);
+    if (nanoseconds) {
+      report << setw(12) << setprecision(3) << nanoseconds / 1e6 << setw(10)
+             << setprecision(0) << double(nanoseconds) / calls;
+    }
+    report << defaultfloat << "\n";
+  }
+  return report.str();
+}
+
+string stats_json() {
+  ostringstream json;
+  json << "{\n  \"enabled\": " << (STATS_ENABLED ? "true" : "false")
+       << ",\n  \"stats\": {\n";
+  for (uint8_t stat = 0; stat < STAT_COUNT; ++stat) {
+    const uint64_t calls = stat_counters[stat].calls.load(memory_order_relaxed);
+    json << "    \"" << STAT_NAMES[stat] << "\": {\"calls\": " << calls
+         << ", \"nanoseconds\": "
+         << stat_counters[stat].nanoseconds.load(memory_order_relaxed)
+         << ", \"per_move\": " << fixed << setprecision(3) << per_move(calls)
+         << defaultfloat << "}" << (stat + 1 < STAT_COUNT ? "," : "") << "\n";
+  }
+  json << "  }\n}\n";
+  return json.str();
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+/**
+ * Counters and timers of the library's hot paths, to see where time goes
+ * without a profiler. They are only compiled in when the build defines
+ * CHESS_STATS (the CMake option of the same name); otherwise every call
+ * below is empty and optimised away.
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#ifdef CHESS_STATS
+constexpr bool STATS_ENABLED = true;
+#else
+constexpr bool STATS_ENABLED = false;
+#endif
+
+enum Stat : uint8_t {
+  // decode_move by notation, e.g. "O-O", "e4", "dxe4" and "Nbd7"
+  DECODE_CASTLING,
+  DECODE_PAWN_PUSH,
+  DECODE_PAWN_CAPTURE,
+  DECODE_PIECE,
+  // find_attacking_pieces by the piece it looks for, in the order of Piece
+  ATTACKING_PAWNS,
+  ATTACKING_KNIGHTS,
+  ATTACKING_BISHOPS,
+  ATTACKING_ROOKS,
+  ATTACKING_QUEENS,
+  ATTACKING_KINGS,
+  IS_ATTACKED,
+  GAME_COPIES,
+  MOVES_APPLIED,
+  HEAP_ALLOCATIONS,
+  STAT_COUNT,
+};
+
+constexpr std::array<std::string_view, STAT_COUNT> STAT_NAMES = {
+    "decode_move.castling",
+    "decode_move.pawn_push",
+    "decode_move.pawn_capture",
+    "decode_move.piece",
+    "find_attacking_pieces.pawn",
+    "find_attacking_pieces.knight",
+    "find_attacking_pieces.bishop",
+    "find_attacking_pieces.rook",
+    "find_attacking_pieces.queen",
+    "find_attacking_pieces.king",
+    "is_attacked",
+    "game_copies",
+    "apply_move",
+    "heap_allocations",
+};
+
+/**
+ * Totals since the start of the program. Threads add to them with relaxed
+ * atomics, which is cheap but not free, hence the build option.
+ */
+struct StatCounter {
+  std::atomic<uint64_t> calls = 0;
+  /** Only counted by StatTimer */
+  std::atomic<uint64_t> nanoseconds = 0;
+};
+
+extern std::array<StatCounter, STAT_COUNT> stat_counters;
+
+inline void count_stat(const Stat stat) {
+  if constexpr (STATS_ENABLED) {
+    stat_counters[stat].calls.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+/** Counts a call and the time until it goes out of scope */
+class StatTimer {
+  Stat stat;
+  std::chrono::steady_clock::time_point start;
+
+ public:
+  explicit StatTimer(const Stat stat) : stat(stat) {
+    if constexpr (STATS_ENABLED) {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  StatTimer(const StatTimer &) = delete;
+  StatTimer &operator=(const StatTimer &) = delete;
+
+  ~StatTimer() {
+    if constexpr (STATS_ENABLED) {
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      count_stat(stat);
+      stat_counters[stat].nanoseconds.fetch_add(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+          std::memory_order_relaxed
+      );
+    }
+  }
+};
+
+/**
+ * Member that counts copies of the object it belongs to. Moves are not
+ * counted, they are cheap.
+ */
+template <Stat stat>
+struct CopyCounter {
+  CopyCounter() = default;
+  CopyCounter(CopyCounter &&) = default;
+  CopyCounter &operator=(CopyCounter &&) = default;
+
+  CopyCounter(const CopyCounter &) {
+    count_stat(stat);
+  }
+
+  CopyCounter &operator=(const CopyCounter &) {
+    count_stat(stat);
+    return *this;
+  }
+};
+
+/** Counts, total and average time of every statistic, one per line */
+std::string stats_report();
+
+/** The statistics as a JSON object, with averages per move applied */
+std::string stats_json();
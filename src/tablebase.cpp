@@ -0,0 +1,231 @@
+#include "tablebase.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <unistd.h>
+
+using namespace std;
+
+constexpr char PIECE_LETTERS[] = "PNBRQK";
+
+optional<Material> parse_material(const string &name) {
+  if (name.size() < 2 || name.size() > 2 + TABLEBASE_MAX_PIECES
+      || name.front() != 'K' || name.back() != 'K') {
+    return nullopt;
+  }
+  Material material = {0, {}};
+  for (const char letter : name.substr(1, name.size() - 2)) {
+    const char *found = strchr(PIECE_LETTERS, letter);
+    if (!found || letter == 'K' || letter == '\0') {
+      return nullopt;
+    }
+    material.pieces[material.count++] = static_cast<Piece>(found - PIECE_LETTERS);
+  }
+  if (material.count == 2 && material.pieces[0] < material.pieces[1]) {
+    swap(material.pieces[0], material.pieces[1]);
+  }
+  return material;
+}
+
+string to_string(const Material &material) {
+  string name = "K";
+  for (uint8_t i = 0; i < material.count; ++i) {
+    name += PIECE_LETTERS[material.pieces[i]];
+  }
+  return name + "K";
+}
+
+vector<Material> all_materials() {
+  vector<Material> materials;
+  for (const Piece piece : {QUEEN, ROOK, PAWN}) {
+    materials.push_back({1, {piece}});
+  }
+  // pawns promote into the pawnless tables, two pawns into one pawn
+  for (const bool pawns : {false, true}) {
+    for (const Piece first : {QUEEN, ROOK, BISHOP, KNIGHT, PAWN}) {
+      for (const Piece second : {QUEEN, ROOK, BISHOP, KNIGHT, PAWN}) {
+        if (second <= first && (second == PAWN) == pawns) {
+          materials.push_back({2, {first, second}});
+        }
+      }
+    }
+  }
+  return materials;
+}
+
+string tablebase_file_name(const Material &material) {
+  return to_string(material) + ".tb";
+}
+
+// Squares of the a1-d1-d4 triangle and the reverse mapping, -1 outside
+constexpr array<uint8_t, 10> TRIANGLE = {0, 1, 2, 3, 9, 10, 11, 18, 19, 27};
+constexpr array<int8_t, 64> TRIANGLE_INDEX = [] {
+  array<int8_t, 64> index = {};
+  index.fill(-1);
+  for (uint8_t i = 0; i < TRIANGLE.size(); ++i) {
+    index[TRIANGLE[i]] = i;
+  }
+  return index;
+}();
+
+/** Bit 0 mirrors the files, bit 1 the ranks, bit 2 swaps files and ranks */
+constexpr uint8_t transform(uint8_t square, const uint8_t symmetry) {
+  if (symmetry & 1) {
+    square ^= 7;
+  }
+  if (symmetry & 2) {
+    square ^= 56;
+  }
+  if (symmetry & 4) {
+    square = (square & 7) << 3 | square >> 3;
+  }
+  return square;
+}
+
+size_t tablebase_size(const Material &material) {
+  size_t size = (material.has_pawns() ? 32 : TRIANGLE.size()) * 64 * 2;
+  for (uint8_t i = 0; i < material.count; ++i) {
+    size *= 64;
+  }
+  return size;
+}
+
+size_t tablebase_index(const TablebasePosition &position) {
+  const Material material = {position.count, position.pieces};
+  const bool pawns = material.has_pawns();
+  uint8_t symmetry = (position.strong_king & 7) > 3;
+  if (!pawns) {
+    symmetry |= (position.strong_king >> 3) > 3 ? 2 : 0;
+    const uint8_t king = transform(position.strong_king, symmetry);
+    symmetry |= (king >> 3) > (king & 7) ? 4 : 0;
+  }
+  const uint8_t king = transform(position.strong_king, symmetry);
+  size_t index = pawns ? (king >> 3) * 4 + (king & 7) : TRIANGLE_INDEX[king];
+  index = index * 64 + transform(position.weak_king, symmetry);
+  for (uint8_t i = 0; i < position.count; ++i) {
+    index = index * 64 + transform(position.squares[i], symmetry);
+  }
+  return index * 2 + position.strong_to_move;
+}
+
+TablebasePosition tablebase_position(const Material &material, size_t index) {
+  TablebasePosition position = {bool(index & 1), 0, 0, material.count, material.pieces, {}};
+  index /= 2;
+  for (uint8_t i = material.count; i-- > 0; index /= 64) {
+    position.squares[i] = index % 64;
+  }
+  position.weak_king = index % 64;
+  index /= 64;
+  position.strong_king =
+      material.has_pawns() ? (index / 4) * 8 + index % 4 : TRIANGLE[index];
+  return position;
+}
+
+optional<TablebasePosition> to_tablebase_position(const Game &game) {
+  const Board &board = game.board;
+  if (popcount(board.occupied) > 2 + TABLEBASE_MAX_PIECES
+      || game.can_castle[white].king_side || game.can_castle[white].queen_side
+      || game.can_castle[black].king_side || game.can_castle[black].queen_side) {
+    return nullopt;
+  }
+  Color strong;
+  if (board.colors[black] == board.of({black, KING})) {
+    strong = white;
+  } else if (board.colors[white] == board.of({white, KING})) {
+    strong = black;
+  } else {
+    return nullopt;
+  }
+  // the strong side always plays up the board
+  const uint8_t flip = strong ? 0 : 56;
+  TablebasePosition position = {
+      game.turn == strong,
+      uint8(countr_zero(board.of({strong, KING})) ^ flip),
+      uint8(countr_zero(board.of({invert(strong), KING})) ^ flip),
+      0,
+      {},
+      {}};
+  Bitboard pieces = board.colors[strong] & ~board.pieces[KING];
+  while (pieces) {
+    const uint8_t square = pop_square(pieces);
+    position.pieces[position.count] = board.mailbox[square]->piece;
+    position.squares[position.count++] = square ^ flip;
+  }
+  if (position.count == 2 && position.pieces[0] < position.pieces[1]) {
+    swap(position.pieces[0], position.pieces[1]);
+    swap(position.squares[0], position.squares[1]);
+  }
+  return position;
+}
+
+TablebaseFile::TablebaseFile(const string &path, const Material &expected)
+    : file(path) {
+  const string_view data = file.view();
+  const auto *bytes = reinterpret_cast<const uint8_t *>(data.data());
+  // distances are read as 16 bit plies
+  if (data.size() < HEADER_SIZE || data.substr(0, 4) != "CHTB"
+      || bytes[4] != VERSION || bytes[5] > 16 || bytes[6] > TABLEBASE_MAX_PIECES) {
+    throw path + " is not a tablebase.";
+  }
+  distance_bits = bytes[5];
+  material.count = bytes[6];
+  for (uint8_t i = 0; i < material.count; ++i) {
+    if (bytes[7 + i] >= KING) {
+      throw path + " is not a tablebase.";
+    }
+    material.pieces[i] = static_cast<Piece>(bytes[7 + i]);
+  }
+  if (material.count != expected.count
+      || !equal(
+          material.pieces.begin(), material.pieces.begin() + material.count,
+          expected.pieces.begin()
+      )) {
+    throw path + " holds " + to_string(material) + " instead of "
+        + to_string(expected) + ".";
+  }
+  size = tablebase_size(material);
+  wdl = bytes + HEADER_SIZE;
+  distances = wdl + (size + 3) / 4;
+  if (data.size() != HEADER_SIZE + (size + 3) / 4 + (size * distance_bits + 7) / 8 + 8) {
+    throw path + " has the wrong size.";
+  }
+}
+
+TablebaseResult TablebaseFile::probe(const size_t index) const {
+  const Wdl result = static_cast<Wdl>(wdl[index / 4] >> index % 4 * 2 & 0b11);
+  const size_t bit = index * distance_bits;
+  uint64_t word;  // the files are little-endian, as is every host this runs on
+  memcpy(&word, distances + bit / 8, sizeof(word));
+  const uint16_t plies = word >> bit % 8 & ((1 << distance_bits) - 1);
+  return {result, plies};
+}
+
+Tablebases::Tablebases(const string &directory) {
+  for (const Material &material : all_materials()) {
+    const string path = directory + "/" + tablebase_file_name(material);
+    if (access(path.c_str(), R_OK) == 0) {
+      tables[material.code()] = make_unique<TablebaseFile>(path, material);
+    }
+  }
+}
+
+size_t Tablebases::count() const {
+  return ranges::count_if(tables, [](const auto &table) { return table != nullptr; });
+}
+
+optional<TablebaseResult> Tablebases::probe(const TablebasePosition &position) const {
+  const Material material = {position.count, position.pieces};
+  if (material.is_insufficient()) {
+    return TablebaseResult{Wdl::DRAW, 0};
+  }
+  const unique_ptr<TablebaseFile> &table = tables[material.code()];
+  if (!table) {
+    return nullopt;
+  }
+  const TablebaseResult result = table->probe(tablebase_index(position));
+  if (result.wdl == Wdl::ILLEGAL) {
+    return nullopt;
+  }
+  return result;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+/**
+ * Endgame tablebases: the value of every position of an ending with a lone
+ * King against a King and up to two other pieces, as generated by
+ * chess-tbgen. Files are mapped and probed in constant time without
+ * allocating.
+ */
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "board.h"
+#include "mapped_file.h"
+
+constexpr uint8_t TABLEBASE_MAX_PIECES = 2;
+
+/**
+ * A position in a form that is independent of the color that has the
+ * pieces: the strong side's King and pieces against the weak side's King.
+ * The side to move is relative too.
+ */
+struct TablebasePosition {
+  bool strong_to_move;
+  uint8_t strong_king;
+  uint8_t weak_king;
+  uint8_t count;
+  /** Sorted from the most to the least valuable piece */
+  std::array<Piece, TABLEBASE_MAX_PIECES> pieces;
+  std::array<uint8_t, TABLEBASE_MAX_PIECES> squares;
+};
+
+/** Result from the point of view of the side to move */
+enum class Wdl : uint8_t { DRAW, WIN, LOSS, ILLEGAL };
+
+struct TablebaseResult {
+  Wdl wdl;
+  /** Plies to mate for wins and losses */
+  uint16_t plies;
+};
+
+/** The pieces of an ending besides the two Kings, e.g. {ROOK} for KRK */
+struct Material {
+  uint8_t count;
+  std::array<Piece, TABLEBASE_MAX_PIECES> pieces;
+
+  /** Unique small number for each material, used to find its table */
+  constexpr uint8_t code() const {
+    uint8_t code = 0;
+    for (uint8_t i = 0; i < count; ++i) {
+      code = code * 6 + pieces[i] + 1;
+    }
+    return code;
+  }
+
+  constexpr bool has_pawns() const {
+    for (uint8_t i = 0; i < count; ++i) {
+      if (pieces[i] == PAWN) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /** No sequence of moves can end in mate: a bare King or one minor piece */
+  constexpr bool is_insufficient() const {
+    return count == 0 || (count == 1 && (pieces[0] == KNIGHT || pieces[0] == BISHOP));
+  }
+};
+
+constexpr size_t MATERIAL_CODES = 6 * 6 + 6 + 1;
+
+/** Name such as "KBNK", or nullopt for anything else than a K…K ending */
+std::optional<Material> parse_material(const std::string &name);
+std::string to_string(const Material &material);
+
+/**
+ * Positions are indexed by the strong King's square, reduced by symmetry,
+ * then the weak King's and every piece's square, and the side to move last.
+ * Without pawns the board has eight symmetries and the strong King is moved
+ * into the a1-d1-d4 triangle (10 squares); pawns only allow mirroring the
+ * files, which leaves the a-d files (32 squares).
+ */
+size_t tablebase_size(const Material &material);
+size_t tablebase_index(const TablebasePosition &position);
+/** Position with the given index; the inverse of tablebase_index */
+TablebasePosition tablebase_position(const Material &material, size_t index);
+
+/** Position of a game if it is one that tablebases can contain */
+std::optional<TablebasePosition> to_tablebase_position(const Game &game);
+
+/**
+ * File layout: a 16 byte header with "CHTB", a version, the number of bits
+ * per distance and the material, then 2 bits of Wdl per position and a
+ * distance in plies per position, both packed least significant bit first.
+ */
+class TablebaseFile {
+  MappedFile file;
+  Material material;
+  uint8_t distance_bits;
+  size_t size;
+  const uint8_t *wdl;
+  const uint8_t *distances;
+
+ public:
+  static constexpr size_t HEADER_SIZE = 16;
+  static constexpr uint8_t VERSION = 1;
+
+  /** Throws unless the file is a valid table of the expected material */
+  TablebaseFile(const std::string &path, const Material &expected);
+
+  const Material &get_material() const {
+    return material;
+  }
+
+  TablebaseResult probe(size_t index) const;
+};
+
+/** All tables found in one directory */
+class Tablebases {
+  std::array<std::unique_ptr<TablebaseFile>, MATERIAL_CODES> tables;
+
+ public:
+  /** Opens every known table in the directory, missing ones are skipped. */
+  explicit Tablebases(const std::string &directory);
+
+  size_t count() const;
+
+  std::optional<TablebaseResult> probe(const TablebasePosition &position) const;
+
+  std::optional<TablebaseResult> probe(const Game &game) const {
+    const std::optional<TablebasePosition> position = to_tablebase_position(game);
+    return position ? probe(*position) : std::nullopt;
+  }
+};
+
+/** Every material tables can be made for, in the order they depend on each other */
+std::vector<Material> all_materials();
+
+std::string tablebase_file_name(const Material &material);
@@ -0,0 +1,561 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "board.h"
+#include "tablebase.h"
+
+using namespace std;
+
+/**
+ * Generate endgame tablebases for chess-cli by retrograde analysis.
+ *
+ * Starting from the mates, every pass walks the moves backwards from the
+ * positions decided in the previous one: a position that can move into a
+ * lost one is won one ply later, and a position whose moves all lead into
+ * won ones is lost. Captures and promotions leave the table and are looked
+ * up in the tables generated before.
+ */
+
+constexpr char USAGE_TEXT[] =
+    ("Usage: chess-tbgen [--threads <n>] [--out <directory>] [<ending> ...]\n"
+     "  <ending>           e.g. KQK or KBNK, defaults to KQK KRK KPK KBNK\n"
+     "  --threads <n>      number of threads, defaults to all cores\n"
+     "  --out <directory>  where to write and look up tables, default '.'\n");
+
+constexpr Bitboard bit(const uint8_t square) {
+  return Bitboard(1) << square;
+}
+
+Bitboard occupancy(const TablebasePosition &position) {
+  Bitboard occupied = bit(position.strong_king) | bit(position.weak_king);
+  for (uint8_t i = 0; i < position.count; ++i) {
+    occupied |= bit(position.squares[i]);
+  }
+  return occupied;
+}
+
+/** Squares the strong side attacks, leaving out one piece if asked to */
+Bitboard strong_attacks(
+    const TablebasePosition &position, const Bitboard occupied, const int skip = -1
+) {
+  Bitboard attacked = ATTACKS.king[position.strong_king];
+  for (uint8_t i = 0; i < position.count; ++i) {
+    if (i != skip) {
+      attacked |= attacks({white, position.pieces[i]}, position.squares[i], occupied);
+    }
+  }
+  return attacked;
+}
+
+/** The same position mirrored along the a1-h8 diagonal */
+TablebasePosition transpose(TablebasePosition position) {
+  const auto square = [](const uint8_t square) -> uint8_t {
+    return (square & 7) << 3 | square >> 3;
+  };
+  position.strong_king = square(position.strong_king);
+  position.weak_king = square(position.weak_king);
+  for (uint8_t i = 0; i < position.count; ++i) {
+    position.squares[i] = square(position.squares[i]);
+  }
+  return position;
+}
+
+bool is_legal(const TablebasePosition &position) {
+  const Bitboard occupied = occupancy(position);
+  if (popcount(occupied) != 2 + position.count
+      || ATTACKS.king[position.strong_king] & bit(position.weak_king)) {
+    return false;
+  }
+  for (uint8_t i = 0; i < position.count; ++i) {
+    if (position.pieces[i] == PAWN && (position.squares[i] < 8 || position.squares[i] >= 56)) {
+      return false;
+    }
+  }
+  // the weak side must not be in check when it is not its move
+  return !position.strong_to_move
+      || !(strong_attacks(position, occupied) & bit(position.weak_king));
+}
+
+/** Material after the piece at the given index was captured or promoted */
+TablebasePosition replace_piece(
+    TablebasePosition position, const uint8_t index, const optional<Piece> promotion
+) {
+  if (promotion) {
+    position.pieces[index] = *promotion;
+  } else {
+    --position.count;
+    for (uint8_t i = index; i < position.count; ++i) {
+      position.pieces[i] = position.pieces[i + 1];
+      position.squares[i] = position.squares[i + 1];
+    }
+  }
+  if (position.count == 2 && position.pieces[0] < position.pieces[1]) {
+    swap(position.pieces[0], position.pieces[1]);
+    swap(position.squares[0], position.squares[1]);
+  }
+  return position;
+}
+
+/** Tables that captures and promotions of the given ending lead into */
+vector<Material> dependencies(const Material &material) {
+  vector<Material> result;
+  for (uint8_t i = 0; i < material.count; ++i) {
+    vector<optional<Piece>> replacements = {nullopt};
+    if (material.pieces[i] == PAWN) {
+      replacements.insert(replacements.end(), {QUEEN, ROOK, BISHOP, KNIGHT});
+    }
+    for (const optional<Piece> &replacement : replacements) {
+      TablebasePosition position = {false, 0, 0, material.count, material.pieces, {}};
+      position = replace_piece(position, i, replacement);
+      const Material next = {position.count, position.pieces};
+      if (!next.is_insufficient()) {
+        result.push_back(next);
+      }
+    }
+  }
+  return result;
+}
+
+class Generator {
+  const Material material;
+  const Tablebases &tables;
+  const size_t threads;
+  const size_t size;
+
+  /** Wdl << 14 | plies, from the side to move's point of view. 0 is a draw
+   * until the position is decided. */
+  unique_ptr<atomic<uint16_t>[]> cells;
+  /** Positions decided at each distance, the work of each pass */
+  vector<vector<uint32_t>> decided;
+  /** Positions won by leaving the table, by distance */
+  vector<vector<uint32_t>> won_by_exit;
+  mutex lock;
+
+  static constexpr uint16_t cell(const Wdl wdl, const uint16_t plies) {
+    return static_cast<uint16_t>(wdl) << 14 | plies;
+  }
+
+  TablebaseResult read(const size_t index) const {
+    const uint16_t value = cells[index].load(memory_order_relaxed);
+    return {static_cast<Wdl>(value >> 14), static_cast<uint16_t>(value & 0x3fff)};
+  }
+
+  /** Decide a position unless another thread was first */
+  bool decide(const size_t index, const Wdl wdl, const uint16_t plies) {
+    uint16_t expected = 0;
+    return cells[index].compare_exchange_strong(expected, cell(wdl, plies));
+  }
+
+  /** The outcome of a position outside this table */
+  TablebaseResult probe_exit(const TablebasePosition &position) const {
+    const optional<TablebaseResult> result = tables.probe(position);
+    if (!result) {
+      const Material exit = {position.count, position.pieces};
+      throw "The " + to_string(exit) + " table is missing.";
+    }
+    return *result;
+  }
+
+  /**
+   * Call visit with the result of every legal move, seen from the opponent,
+   * and whether the move left the table. Positions of this table that are
+   * not decided yet count as draws.
+   */
+  template <typename Visit>
+  void for_each_move(const TablebasePosition &position, Visit &&visit) const {
+    const Bitboard occupied = occupancy(position);
+    const auto stay = [this, &visit](TablebasePosition next) {
+      next.strong_to_move = !next.strong_to_move;
+      visit(read(tablebase_index(next)), false);
+    };
+    const auto leave = [this, &visit](TablebasePosition next) {
+      next.strong_to_move = !next.strong_to_move;
+      visit(probe_exit(next), true);
+    };
+
+    if (!position.strong_to_move) {
+      const Bitboard attacked = strong_attacks(position, occupied & ~bit(position.weak_king));
+      Bitboard targets = ATTACKS.king[position.weak_king] & ~ATTACKS.king[position.strong_king]
+                       & ~bit(position.strong_king);
+      while (targets) {
+        TablebasePosition next = position;
+        next.weak_king = pop_square(targets);
+        const Bitboard target = bit(next.weak_king);
+        if (!(occupied & target)) {
+          if (!(attacked & target)) {
+            stay(next);
+          }
+          continue;
+        }
+        for (uint8_t i = 0; i < position.count; ++i) {
+          if (position.squares[i] == next.weak_king
+              && !(strong_attacks(position, occupied & ~bit(position.weak_king), i) & target)) {
+            leave(replace_piece(next, i, nullopt));
+          }
+        }
+      }
+      return;
+    }
+
+    Bitboard targets = ATTACKS.king[position.strong_king] & ~occupied
+                     & ~ATTACKS.king[position.weak_king];
+    while (targets) {
+      TablebasePosition next = position;
+      next.strong_king = pop_square(targets);
+      stay(next);
+    }
+    for (uint8_t i = 0; i < position.count; ++i) {
+      const uint8_t from = position.squares[i];
+      if (position.pieces[i] == PAWN) {
+        if (occupied & bit(from + 8)) {
+          continue;
+        }
+        TablebasePosition next = position;
+        next.squares[i] = from + 8;
+        if (from + 8 >= 56) {
+          for (const Piece promotion : {QUEEN, ROOK, BISHOP, KNIGHT}) {
+            leave(replace_piece(next, i, promotion));
+          }
+          continue;
+        }
+        stay(next);
+        if (from < 16 && !(occupied & bit(from + 16))) {
+          next.squares[i] = from + 16;
+          stay(next);
+        }
+        continue;
+      }
+      Bitboard moves = attacks({white, position.pieces[i]}, from, occupied) & ~occupied;
+      while (moves) {
+        TablebasePosition next = position;
+        next.squares[i] = pop_square(moves);
+        stay(next);
+      }
+    }
+  }
+
+  /** Call visit with the index of every legal position that can move here */
+  template <typename Visit>
+  void for_each_predecessor(const TablebasePosition &position, Visit &&visit) const {
+    const Bitboard occupied = occupancy(position);
+    const bool pawns = material.has_pawns();
+    const auto add = [&visit, pawns](TablebasePosition previous) {
+      previous.strong_to_move = !previous.strong_to_move;
+      if (!is_legal(previous)) {
+        return;
+      }
+      const size_t index = tablebase_index(previous);
+      visit(index);
+      // With the King on a diagonal, the mirrored position is a separate entry
+      if (!pawns) {
+        const size_t mirrored = tablebase_index(transpose(previous));
+        if (mirrored != index) {
+          visit(mirrored);
+        }
+      }
+    };
+
+    if (position.strong_to_move) {
+      Bitboard origins = ATTACKS.king[position.weak_king] & ~occupied;
+      while (origins) {
+        TablebasePosition previous = position;
+        previous.weak_king = pop_square(origins);
+        add(previous);
+      }
+      return;
+    }
+
+    Bitboard origins = ATTACKS.king[position.strong_king] & ~occupied;
+    while (origins) {
+      TablebasePosition previous = position;
+      previous.strong_king = pop_square(origins);
+      add(previous);
+    }
+    for (uint8_t i = 0; i < position.count; ++i) {
+      const uint8_t to = position.squares[i];
+      if (position.pieces[i] == PAWN) {
+        if (to >= 16 && !(occupied & bit(to - 8))) {
+          TablebasePosition previous = position;
+          previous.squares[i] = to - 8;
+          add(previous);
+          if (to < 32 && !(occupied & bit(to - 16))) {
+            previous.squares[i] = to - 16;
+            add(previous);
+          }
+        }
+        continue;
+      }
+      Bitboard origins = attacks({white, position.pieces[i]}, to, occupied) & ~occupied;
+      while (origins) {
+        TablebasePosition previous = position;
+        previous.squares[i] = pop_square(origins);
+        add(previous);
+      }
+    }
+  }
+
+  /**
+   * Run the work for indices 0 to count on all threads, in chunks. Each
+   * thread collects the positions it decides per distance and adds them to
+   * the given lists once it is done.
+   */
+  template <typename Work>
+  void parallel(const size_t count, vector<vector<uint32_t>> &results, Work &&work) {
+    atomic<size_t> next = 0;
+    const auto run = [&] {
+      vector<vector<uint32_t>> found;
+      const auto found_at = [&found](const uint16_t plies, const size_t index) {
+        if (found.size() <= plies) {
+          found.resize(plies + 1);
+        }
+        found[plies].push_back(index);
+      };
+      constexpr size_t CHUNK = 4096;
+      for (size_t start; (start = next.fetch_add(CHUNK)) < count;) {
+        for (size_t i = start; i < min(start + CHUNK, count); ++i) {
+          work(i, found_at);
+        }
+      }
+      lock_guard guard(lock);
+      if (results.size() < found.size()) {
+        results.resize(found.size());
+      }
+      for (size_t plies = 0; plies < found.size(); ++plies) {
+        results[plies].insert(results[plies].end(), found[plies].begin(), found[plies].end());
+      }
+    };
+    vector<thread> helpers;
+    for (size_t i = 1; i < threads; ++i) {
+      helpers.emplace_back(run);
+    }
+    run();
+    for (thread &helper : helpers) {
+      helper.join();
+    }
+  }
+
+  /** Mates, stalemates, illegal positions and wins by leaving the table */
+  void initialize() {
+    parallel(size, decided, [this](const size_t index, const auto &found_at) {
+      const TablebasePosition position = tablebase_position(material, index);
+      if (!is_legal(position)) {
+        cells[index] = cell(Wdl::ILLEGAL, 0);
+        return;
+      }
+      size_t moves = 0, exit_losses = 0;
+      uint16_t longest_loss = 0;
+      optional<uint16_t> fastest_win = nullopt;
+      for_each_move(position, [&](const TablebaseResult &result, const bool exit) {
+        ++moves;
+        if (exit && result.wdl == Wdl::LOSS) {
+          fastest_win = min<uint16_t>(fastest_win.value_or(UINT16_MAX), result.plies + 1);
+        } else if (exit && result.wdl == Wdl::WIN) {
+          ++exit_losses;
+          longest_loss = max<uint16_t>(longest_loss, result.plies + 1);
+        }
+      });
+      if (moves == 0) {
+        const Bitboard occupied = occupancy(position);
+        const bool in_check =
+            !position.strong_to_move
+            && strong_attacks(position, occupied) & bit(position.weak_king);
+        if (in_check) {
+          cells[index] = cell(Wdl::LOSS, 0);
+          found_at(0, index);
+        }
+      } else if (exit_losses == moves) {
+        cells[index] = cell(Wdl::LOSS, longest_loss);
+        found_at(longest_loss, index);
+      } else if (fastest_win) {
+        lock_guard guard(lock);
+        if (won_by_exit.size() <= *fastest_win) {
+          won_by_exit.resize(*fastest_win + 1);
+        }
+        won_by_exit[*fastest_win].push_back(index);
+      }
+    });
+  }
+
+  /** Decide everything that moves into a position decided at this distance */
+  void pass(const uint16_t plies) {
+    if (plies < won_by_exit.size()) {
+      for (const uint32_t index : won_by_exit[plies]) {
+        if (decide(index, Wdl::WIN, plies)) {
+          decided[plies].push_back(index);
+        }
+      }
+    }
+    const vector<uint32_t> frontier = std::move(decided[plies]);
+    parallel(frontier.size(), decided, [&](const size_t i, const auto &found_at) {
+      const size_t index = frontier[i];
+      const Wdl wdl = read(index).wdl;
+      for_each_predecessor(
+          tablebase_position(material, index),
+          [&](const size_t previous) {
+            if (read(previous).wdl != Wdl::DRAW) {
+              return;
+            }
+            if (wdl == Wdl::LOSS) {
+              if (decide(previous, Wdl::WIN, plies + 1)) {
+                found_at(plies + 1, previous);
+              }
+              return;
+            }
+            // lost only if every move loses, then by the longest way
+            bool lost = true;
+            uint16_t longest = 0;
+            for_each_move(
+                tablebase_position(material, previous),
+                [&](const TablebaseResult &result, bool) {
+                  lost = lost && result.wdl == Wdl::WIN;
+                  longest = max<uint16_t>(longest, result.plies + 1);
+                }
+            );
+            if (lost && decide(previous, Wdl::LOSS, longest)) {
+              found_at(longest, previous);
+            }
+          }
+      );
+    });
+    decided[plies] = frontier;
+  }
+
+ public:
+  Generator(const Material &material, const Tablebases &tables, const size_t threads)
+      : material(material),
+        tables(tables),
+        threads(threads),
+        size(tablebase_size(material)),
+        cells(make_unique<atomic<uint16_t>[]>(size)) {}
+
+  void generate() {
+    initialize();
+    for (uint16_t plies = 0; plies < max(decided.size(), won_by_exit.size()); ++plies) {
+      if (decided.size() <= plies) {
+        decided.resize(plies + 1);
+      }
+      pass(plies);
+    }
+  }
+
+  /** Count positions by their value for the side to move */
+  array<size_t, 4> count() const {
+    array<size_t, 4> counts = {};
+    for (size_t index = 0; index < size; ++index) {
+      ++counts[static_cast<uint8_t>(read(index).wdl)];
+    }
+    return counts;
+  }
+
+  uint16_t longest_mate() const {
+    uint16_t plies = decided.size();
+    while (plies > 0 && decided[plies - 1].empty()) {
+      --plies;
+    }
+    return max(plies, uint16_t(1)) - 1;
+  }
+
+  void write(const string &path) const {
+    const uint8_t bits = max<int>(1, bit_width(longest_mate()));
+    vector<uint8_t> data(TablebaseFile::HEADER_SIZE + (size + 3) / 4 + (size * bits + 7) / 8 + 8);
+    memcpy(data.data(), "CHTB", 4);
+    data[4] = TablebaseFile::VERSION;
+    data[5] = bits;
+    data[6] = material.count;
+    for (uint8_t i = 0; i < material.count; ++i) {
+      data[7 + i] = material.pieces[i];
+    }
+    uint8_t *wdl = data.data() + TablebaseFile::HEADER_SIZE;
+    uint8_t *distances = wdl + (size + 3) / 4;
+    for (size_t index = 0; index < size; ++index) {
+      const TablebaseResult result = read(index);
+      wdl[index / 4] |= static_cast<uint8_t>(result.wdl) << index % 4 * 2;
+      for (uint8_t b = 0; b < bits; ++b) {
+        const size_t bit = index * bits + b;
+        distances[bit / 8] |= (result.plies >> b & 1) << bit % 8;
+      }
+    }
+    ofstream file(path, ios::binary);
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    if (!file) {
+      throw "Can't write '" + path + "'";
+    }
+  }
+};
+
+int main(int argc, char *argv[]) {
+  const vector<string> args(argv + 1, argv + argc);
+  size_t threads = max(1u, thread::hardware_concurrency());
+  string directory = ".";
+  vector<Material> requested;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--threads" && i + 1 < args.size()) {
+      threads = max(1, atoi(args[++i].c_str()));
+    } else if (args[i] == "--out" && i + 1 < args.size()) {
+      directory = args[++i];
+    } else if (const optional<Material> material = parse_material(args[i]);
+               material && !material->is_insufficient()) {
+      requested.push_back(*material);
+    } else {
+      cerr << USAGE_TEXT;
+      return args[i] == "--help" ? 0 : 1;
+    }
+  }
+  if (requested.empty()) {
+    for (const char *name : {"KQK", "KRK", "KPK", "KBNK"}) {
+      requested.push_back(*parse_material(name));
+    }
+  }
+
+  // Add missing tables the requested ones depend on
+  vector<bool> needed(MATERIAL_CODES);
+  for (const Material &material : requested) {
+    needed[material.code()] = true;
+  }
+  const vector<Material> materials = all_materials();
+  for (auto material = materials.rbegin(); material != materials.rend(); ++material) {
+    if (!needed[material->code()]) {
+      continue;
+    }
+    for (const Material &dependency : dependencies(*material)) {
+      const string path = directory + "/" + tablebase_file_name(dependency);
+      needed[dependency.code()] = needed[dependency.code()] || !ifstream(path);
+    }
+  }
+
+  try {
+    for (const Material &material : materials) {
+      if (!needed[material.code()]) {
+        continue;
+      }
+      const auto start = chrono::steady_clock::now();
+      const Tablebases tables(directory);
+      Generator generator(material, tables, threads);
+      generator.generate();
+      const string path = directory + "/" + tablebase_file_name(material);
+      generator.write(path);
+      const chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+      const array<size_t, 4> counts = generator.count();
+      const size_t positions = tablebase_size(material);
+      cout << to_string(material) << ": " << positions << " positions ("
+           << counts[size_t(Wdl::WIN)] << " won, " << counts[size_t(Wdl::DRAW)]
+           << " drawn, " << counts[size_t(Wdl::LOSS)] << " lost, "
+           << counts[size_t(Wdl::ILLEGAL)] << " illegal), longest mate "
+           << generator.longest_mate() << " plies, " << fixed << setprecision(2)
+           << seconds.count() << " s (" << static_cast<uint64_t>(positions / seconds.count())
+           << " positions/s) -> " << path << defaultfloat << endl;
+    }
+  } catch (string err) {
+    cerr << err << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+/**
+ * Fixed size hash table from Zobrist keys to 64 bits of data, shared between
+ * threads without locks. Each entry stores the key XORed with its data, so
+ * an entry torn by concurrent writes no longer matches its key and is simply
+ * treated as a miss.
+ */
+class TranspositionTable {
+  struct Entry {
+    std::atomic<uint64_t> check;
+    std::atomic<uint64_t> data;
+  };
+
+  std::unique_ptr<Entry[]> entries;
+  size_t mask;
+
+ public:
+  /** Allocates the largest power of two number of entries that fits. */
+  explicit TranspositionTable(const size_t megabytes) {
+    const size_t count =
+        std::bit_floor(std::max<size_t>(1, (megabytes << 20) / sizeof(Entry)));
+    entries = std::make_unique<Entry[]>(count);
+    mask = count - 1;
+    clear();
+  }
+
+  void clear() {
+    for (size_t i = 0; i <= mask; ++i) {
+      entries[i].check.store(0, std::memory_order_relaxed);
+      entries[i].data.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  std::optional<uint64_t> probe(const uint64_t key) const {
+    const Entry &entry = entries[key & mask];
+    const uint64_t data = entry.data.load(std::memory_order_relaxed);
+    if ((entry.check.load(std::memory_order_relaxed) ^ data) != key) {
+      return std::nullopt;
+    }
+    return data;
+  }
+
+  void store(const uint64_t key, const uint64_t data) {
+    Entry &entry = entries[key & mask];
+    entry.check.store(key ^ data, std::memory_order_relaxed);
+    entry.data.store(data, std::memory_order_relaxed);
+  }
+};